@@ -0,0 +1,67 @@
+#include "bench.hpp"
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+// headless benchmark for alefsbits. build with `make bench` and run
+// `build/bench [filter]`, where filter picks the cases whose name contains
+// it, e.g. `build/bench nos`. most cases run one second of audio per sample
+// rate and channel count, and every case reports the cost of one sample
+
+volatile float bench_sink = 0.f;
+
+bool bench_selected(const std::string &name, const std::string &filter)
+{
+  return filter.empty() || name.find(filter) != std::string::npos;
+}
+
+void bench_report(const std::string &name, int sample_rate, int channels, int64_t samples, double seconds)
+{
+  double ns_per_sample = seconds * 1e9 / samples;
+  std::printf("%-24s %7d %3d %12.1f %14.0f\n", name.c_str(), sample_rate, channels, ns_per_sample, samples / seconds);
+  std::fflush(stdout);
+}
+
+std::vector<uint8_t> bench_wav(int bit_depth, int channels, int sample_rate, int frames)
+{
+  int bytes = bit_depth / 8;
+  uint32_t data_size = (uint32_t)frames * channels * bytes;
+  std::vector<uint8_t> wav(44 + data_size);
+  uint8_t *p = wav.data();
+  auto put = [&](uint32_t v, int size)
+  {
+    std::memcpy(p, &v, size);
+    p += size;
+  };
+  std::memcpy(p, "RIFF", 4);
+  p += 4;
+  put(36 + data_size, 4);
+  std::memcpy(p, "WAVEfmt ", 8);
+  p += 8;
+  put(16, 4);
+  put(1, 2);
+  put(channels, 2);
+  put(sample_rate, 4);
+  put(sample_rate * channels * bytes, 4);
+  put(channels * bytes, 2);
+  put(bit_depth, 2);
+  std::memcpy(p, "data", 4);
+  p += 4;
+  put(data_size, 4);
+  // quieter than full scale so the samples use every byte but never clip
+  std::mt19937 rng(1);
+  for (uint32_t i = 0; i < data_size / bytes; i++)
+  {
+    int32_t v = (int32_t)(rng() >> (32 - bit_depth)) - (1 << (bit_depth - 1));
+    put((uint32_t)(v / 2), bytes);
+  }
+  return wav;
+}
+
+int main(int argc, char **argv)
+{
+  std::string filter = argc > 1 ? argv[1] : "";
+  std::printf("%-24s %7s %3s %12s %14s\n", "case", "rate", "ch", "ns/sample", "samples/sec");
+  bench_kernels(filter);
+  return 0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// shared bits of the headless benchmark. kernels.cpp times the hot inner
+// loops of the modules on their own
+
+static const int BENCH_SAMPLE_RATES[] = {48000, 96000, 192000};
+static const int BENCH_CHANNELS[] = {1, 4, 16};
+
+struct BenchTimer
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  double seconds() const
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+};
+
+// every timed loop adds its output here, so none of it is optimized away
+extern volatile float bench_sink;
+
+// true if the case should run, an empty filter runs everything
+bool bench_selected(const std::string &name, const std::string &filter);
+// prints one line of results, samples counts steps of a kernel, one per
+// sample of audio, not samples times channels
+void bench_report(const std::string &name, int sample_rate, int channels, int64_t samples, double seconds);
+
+// a wav file of noise, as it would be read from disk
+std::vector<uint8_t> bench_wav(int bit_depth, int channels, int sample_rate, int frames);
+
+void bench_kernels(const std::string &filter);
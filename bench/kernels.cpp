@@ -0,0 +1,177 @@
+#include "bench.hpp"
+#include "../src/inc/AudioFile.h"
+#include "../src/inc/Interpolator.hpp"
+#include "../src/inc/Quantizer.hpp"
+#include "../src/inc/SampleBuffer.hpp"
+#include "../src/inc/WaveMipmap.hpp"
+
+// the inner loops of slips, nos and polyplay, run on their own so a change
+// to one shows up without the rest of the module around it
+
+using simd::float_4;
+
+static const char *VOICE_CASES[INTERPOLATION_MODES_LEN] = {"kernel/voice-linear", "kernel/voice-cubic", "kernel/voice-sinc"};
+
+// slips quantizes every step of its sequence, this quantizes every channel
+// every sample against a built-in scale
+static void bench_quantize(int sample_rate, int channels)
+{
+  std::vector<float> voltages(4096);
+  for (float &v : voltages)
+  {
+    v = random::uniform() * 10.f - 5.f;
+  }
+  Quantizer quantizer;
+  float sum = 0.f;
+  BenchTimer timer;
+  for (int s = 0; s < sample_rate; s++)
+  {
+    const float *in = voltages.data() + (s * MAX_POLY) % (voltages.size() - MAX_POLY);
+    if (channels < 4)
+    {
+      for (int c = 0; c < channels; c++)
+      {
+        sum += quantizer.quantize(in[c], Quantizer::C, Quantizer::MINOR);
+      }
+      continue;
+    }
+    for (int c = 0; c < channels; c += 4)
+    {
+      float_4 out = quantizer.quantizeSimd(float_4::load(in + c), Quantizer::C, Quantizer::MINOR);
+      sum += out[0];
+    }
+  }
+  double seconds = timer.seconds();
+  bench_sink = bench_sink + sum;
+  bench_report("kernel/quantize", sample_rate, channels, sample_rate, seconds);
+}
+
+// the read loop of NoiseOSC::next4, voices spread over a few octaves
+static void bench_mipmap(int sample_rate, int channels)
+{
+  std::vector<float> table(64);
+  for (float &v : table)
+  {
+    v = random::uniform() * 2.f - 1.f;
+  }
+  WaveMipmap mipmap;
+  mipmap.build(0, table.data(), (int)table.size());
+  float_4 phase[MAX_POLY / 4] = {};
+  float_4 inc[MAX_POLY / 4];
+  for (int c = 0; c < MAX_POLY; c++)
+  {
+    inc[c / 4][c % 4] = dsp::FREQ_C4 * std::pow(2.f, c / 4.f) / sample_rate;
+  }
+  float_4 sum = 0.f;
+  BenchTimer timer;
+  for (int s = 0; s < sample_rate; s++)
+  {
+    for (int c = 0; c < channels; c += 4)
+    {
+      float_4 &p = phase[c / 4];
+      p += inc[c / 4];
+      p -= simd::floor(p);
+      sum += mipmap.read4(c, p, simd::log2(simd::fmax(inc[c / 4], 1e-6f) * MIPMAP_SIZE));
+    }
+  }
+  double seconds = timer.seconds();
+  bench_sink = bench_sink + sum[0];
+  bench_report("kernel/nos-mipmap", sample_rate, channels, sample_rate, seconds);
+}
+
+// polyplay voices reading a long stereo file at scattered positions and
+// slightly different rates, the case that misses the cache the most
+static void bench_voice_reads(int sample_rate, int channels, int interpolation, const SampleBuffer &buffer)
+{
+  double position[MAX_POLY];
+  double step[MAX_POLY];
+  for (int c = 0; c < MAX_POLY; c++)
+  {
+    position[c] = (double)buffer.length * c / MAX_POLY;
+    step[c] = 48000.0 / sample_rate * (1.0 + c * 0.01);
+  }
+  const float *left = buffer.channel(0);
+  const float *right = buffer.channel(1);
+  float sum = 0.f;
+  BenchTimer timer;
+  for (int s = 0; s < sample_rate; s++)
+  {
+    for (int c = 0; c < channels; c++)
+    {
+      sum += Interpolator::read(interpolation, left, buffer.length, position[c], step[c]);
+      sum += Interpolator::read(interpolation, right, buffer.length, position[c], step[c]);
+      position[c] += step[c];
+      if (position[c] >= buffer.length)
+      {
+        position[c] -= buffer.length;
+      }
+    }
+  }
+  double seconds = timer.seconds();
+  bench_sink = bench_sink + sum;
+  bench_report(VOICE_CASES[interpolation], sample_rate, channels, sample_rate, seconds);
+}
+
+// polyplay decoding a minute of stereo from memory, reported per frame
+static void bench_wav_decode(int bit_depth)
+{
+  std::vector<uint8_t> wav = bench_wav(bit_depth, 2, 48000, 48000 * 60);
+  AudioFile<float> file;
+  BenchTimer timer;
+  file.loadFromMemory(wav);
+  double seconds = timer.seconds();
+  bench_sink = bench_sink + file.samples[0][0];
+  bench_report("kernel/wav-decode" + std::to_string(bit_depth), 48000, 2, 48000 * 60, seconds);
+}
+
+void bench_kernels(const std::string &filter)
+{
+  random::init();
+  // a minute of stereo at 48k, well past any cache
+  SampleBuffer buffer;
+  bool reads = false;
+  for (const char *name : VOICE_CASES)
+  {
+    reads |= bench_selected(name, filter);
+  }
+  if (reads)
+  {
+    buffer.allocate(2, 48000 * 60);
+    for (int c = 0; c < 2; c++)
+    {
+      float *data = buffer.channel(c);
+      for (int64_t i = 0; i < buffer.length; i++)
+      {
+        data[i] = random::uniform() * 2.f - 1.f;
+      }
+    }
+  }
+  for (int bit_depth : {16, 24})
+  {
+    if (bench_selected("kernel/wav-decode" + std::to_string(bit_depth), filter))
+    {
+      bench_wav_decode(bit_depth);
+    }
+  }
+  for (int sample_rate : BENCH_SAMPLE_RATES)
+  {
+    for (int channels : BENCH_CHANNELS)
+    {
+      if (bench_selected("kernel/quantize", filter))
+      {
+        bench_quantize(sample_rate, channels);
+      }
+      if (bench_selected("kernel/nos-mipmap", filter))
+      {
+        bench_mipmap(sample_rate, channels);
+      }
+      for (int mode = 0; mode < INTERPOLATION_MODES_LEN; mode++)
+      {
+        if (bench_selected(VOICE_CASES[mode], filter))
+        {
+          bench_voice_reads(sample_rate, channels, mode, buffer);
+        }
+      }
+    }
+  }
+}
@@ -47,6 +47,35 @@
 #include <iterator>
 #include <algorithm>
 #include <limits>
+#include <cmath>
+
+// an AVX2 build of the PCM conversion kernels is picked at runtime where the
+// compiler can build one without it being enabled for the whole file
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define AUDIOFILE_PCM_DISPATCH 1
+#define AUDIOFILE_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define AUDIOFILE_PCM_DISPATCH 0
+#define AUDIOFILE_ALWAYS_INLINE inline
+#endif
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOGDI
+#define NOGDI
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 // disable some warnings on Windows
 #if defined(_MSC_VER)
@@ -75,6 +104,141 @@ _Pragma("GCC diagnostic push")
         Aiff
     };
 
+//=============================================================
+/** A read-only memory mapping of a whole file. WAV files are decoded
+ * straight out of the mapping rather than being copied into a
+ * std::vector first, which avoids holding the raw file and the decoded
+ * samples in memory at the same time
+ */
+class AudioFileMapping
+{
+public:
+    //=============================================================
+    AudioFileMapping() = default;
+    AudioFileMapping(const AudioFileMapping &) = delete;
+    AudioFileMapping &operator=(const AudioFileMapping &) = delete;
+    ~AudioFileMapping() { close(); }
+
+    //=============================================================
+    /** Maps the file at the given path.
+     * @Returns true if the file was mapped
+     */
+    bool open(const std::string &filePath);
+
+    /** Unmaps the file, if one is mapped */
+    void close();
+
+    //=============================================================
+    /** @Returns a pointer to the first byte of the file */
+    const uint8_t *data() const { return mappedData; }
+
+    /** @Returns the size of the file in bytes */
+    size_t size() const { return mappedSize; }
+
+private:
+    //=============================================================
+    const uint8_t *mappedData = nullptr;
+    size_t mappedSize = 0;
+#if defined(_WIN32)
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mappingHandle = NULL;
+#endif
+};
+
+//=============================================================
+/** The containers a WAV file can come in. RF64 (and BW64, which is laid out
+ * the same) keeps 64-bit sizes in a ds64 chunk for files over 4GB, and
+ * Sony Wave64 uses 64-bit sizes and GUID chunk IDs throughout
+ */
+enum class WaveContainer
+{
+    None,
+    Riff,
+    RF64,
+    Wave64
+};
+
+//=============================================================
+/** A chunk header from any of the WAV containers */
+class WaveChunkHeader
+{
+public:
+    //=============================================================
+    /** @Returns the container of a file from its first 40 bytes, or fewer if the file is shorter */
+    static WaveContainer getContainer(const uint8_t *bytes, size_t numBytes);
+
+    /** @Returns the offset of the first chunk in a file */
+    static uint64_t getFirstChunk(WaveContainer container) { return container == WaveContainer::Wave64 ? 40 : 12; }
+
+    /** @Returns the size of a chunk header, and so how many bytes read() needs */
+    static int getHeaderSize(WaveContainer container) { return container == WaveContainer::Wave64 ? 24 : 8; }
+
+    //=============================================================
+    /** Reads a chunk header. For Wave64 the four character code is taken from
+     * the front of the GUID, and left blank if the GUID isn't one of the
+     * registered WAV ones
+     */
+    void read(const uint8_t *bytes, WaveContainer container);
+
+    /** @Returns true if this is the chunk with the given four character code */
+    bool is(const char *fourcc) const { return memcmp(id, fourcc, 4) == 0; }
+
+    /** @Returns the offset of the chunk after this one, which starts at chunkStart */
+    uint64_t getNextChunk(uint64_t chunkStart) const;
+
+    //=============================================================
+    char id[4] = {0};
+    uint64_t headerSize = 0;
+    uint64_t bodySize = 0;
+    bool wave64 = false;
+
+    //=============================================================
+    /** RF64 marks the sizes it keeps in the ds64 chunk with this */
+    static constexpr uint32_t rf64SizeMarker = 0xFFFFFFFF;
+
+    /** @Returns a little endian 64-bit value */
+    static uint64_t readUInt64(const uint8_t *bytes);
+};
+
+//=============================================================
+/** Bulk conversion of little endian PCM into floating point samples. Each
+ * kernel reads one channel out of interleaved frames that are srcStride bytes
+ * apart, and writes it to every dstStride'th element of dst. The loops have
+ * no branches or calls in them so the compiler can vectorise them, and on x86
+ * an AVX2 build of each one is chosen at runtime if the CPU supports it
+ */
+class PCMConverter
+{
+public:
+    //=============================================================
+    /** Converts numSamples samples of the given bit depth.
+     * @Returns false if the bit depth isn't supported
+     */
+    template <class T>
+    static bool convert(const uint8_t *src, size_t srcStride, T *dst, size_t dstStride, size_t numSamples, int bitDepth, bool isFloat);
+
+private:
+    //=============================================================
+    template <class T>
+    static void convert8(const uint8_t *src, size_t srcStride, T *dst, size_t dstStride, size_t numSamples);
+    template <class T>
+    static void convert16(const uint8_t *src, size_t srcStride, T *dst, size_t dstStride, size_t numSamples);
+    template <class T>
+    static void convert24(const uint8_t *src, size_t srcStride, T *dst, size_t dstStride, size_t numSamples);
+    template <class T>
+    static void convert32(const uint8_t *src, size_t srcStride, T *dst, size_t dstStride, size_t numSamples);
+    template <class T>
+    static void convertFloat(const uint8_t *src, size_t srcStride, T *dst, size_t dstStride, size_t numSamples);
+
+    template <class T>
+    static void convertDefault(const uint8_t *src, size_t srcStride, T *dst, size_t dstStride, size_t numSamples, int bitDepth, bool isFloat);
+#if AUDIOFILE_PCM_DISPATCH
+    template <class T>
+    static void convertAVX2(const uint8_t *src, size_t srcStride, T *dst, size_t dstStride, size_t numSamples, int bitDepth, bool isFloat);
+    static bool hasAVX2();
+#endif
+};
+
 //=============================================================
 template <class T>
 class AudioFile
@@ -184,6 +348,7 @@ private:
     //=============================================================
     AudioFileFormat determineAudioFileFormat(std::vector<uint8_t> &fileData);
     bool decodeWaveFile(std::vector<uint8_t> &fileData);
+    bool decodeWaveFile(const uint8_t *fileData, size_t fileSize);
     bool decodeAiffFile(std::vector<uint8_t> &fileData);
 
     //=============================================================
@@ -195,9 +360,12 @@ private:
 
     //=============================================================
     int32_t fourBytesToInt(std::vector<uint8_t> &source, int startIndex, Endianness endianness = Endianness::LittleEndian);
+    int32_t fourBytesToInt(const uint8_t *source, size_t startIndex, Endianness endianness = Endianness::LittleEndian);
     int16_t twoBytesToInt(std::vector<uint8_t> &source, int startIndex, Endianness endianness = Endianness::LittleEndian);
+    int16_t twoBytesToInt(const uint8_t *source, size_t startIndex, Endianness endianness = Endianness::LittleEndian);
     int getIndexOfString(std::vector<uint8_t> &source, std::string s);
     int getIndexOfChunk(std::vector<uint8_t> &source, const std::string &chunkHeaderID, int startIndex, Endianness endianness = Endianness::LittleEndian);
+    int getIndexOfChunk(const uint8_t *source, size_t sourceSize, const std::string &chunkHeaderID, int startIndex, Endianness endianness = Endianness::LittleEndian);
 
     //=============================================================
     T sixteenBitIntToSample(int16_t sample);
@@ -271,10 +439,361 @@ enum AIFFAudioFormat
     Error
 };
 
+//=============================================================
+/** Reads a WAV or AIFF file a block of frames at a time. The chunk headers
+ * are parsed once by open(), and samples are converted as they are read, so
+ * the memory used stays the same however long the file is
+ */
+template <class T>
+class AudioFileReader
+{
+public:
+    //=============================================================
+    AudioFileReader() = default;
+    AudioFileReader(const AudioFileReader &) = delete;
+    AudioFileReader &operator=(const AudioFileReader &) = delete;
+    ~AudioFileReader() { close(); }
+
+    //=============================================================
+    /** Opens a file and reads its format and data chunk position.
+     * @Returns true if the file could be opened and has a supported format
+     */
+    bool open(const std::string &filePath);
+
+    /** Closes the file */
+    void close();
+
+    //=============================================================
+    /** Moves the read position to the given frame.
+     * @Returns false if the frame is past the end of the file
+     */
+    bool seek(int64_t frame);
+
+    /** Reads up to numFrames frames from the read position into dst, with the
+     * channels of each frame interleaved. dst must have room for
+     * numFrames * getNumChannels() samples
+     * @Returns the number of frames read
+     */
+    int readFrames(T *dst, int numFrames);
+
+    //=============================================================
+    /** @Returns true if a file is open */
+    bool isOpen() const { return numFrames > 0; }
+
+    /** @Returns the number of audio channels in the file */
+    int getNumChannels() const { return numChannels; }
+
+    /** @Returns the sample rate of the file */
+    uint32_t getSampleRate() const { return sampleRate; }
+
+    /** @Returns the bit depth of the file */
+    int getBitDepth() const { return bitDepth; }
+
+    /** @Returns the number of frames per channel in the file */
+    int64_t getNumFrames() const { return numFrames; }
+
+    /** @Returns the frame the next read starts at */
+    int64_t getPosition() const { return position; }
+
+private:
+    //=============================================================
+    static constexpr int blockFrames = 4096;
+
+    //=============================================================
+    static uint32_t readUInt32(const uint8_t *bytes, bool bigEndian);
+    static uint16_t readUInt16(const uint8_t *bytes, bool bigEndian);
+    static uint32_t readExtendedSampleRate(const uint8_t *bytes);
+    T decodeSample(const uint8_t *bytes) const;
+
+    //=============================================================
+    std::ifstream file;
+    std::vector<uint8_t> block;
+    int numChannels = 0;
+    uint32_t sampleRate = 0;
+    int bitDepth = 0;
+    int bytesPerFrame = 0;
+    bool isFloat = false;
+    bool isAiff = false;
+    bool bigEndian = false;
+    int64_t dataStart = 0;
+    int64_t numFrames = 0;
+    int64_t position = 0;
+    int64_t filePosition = -1;
+};
+
 //=============================================================
 /* IMPLEMENTATION */
 //=============================================================
 
+//=============================================================
+inline bool AudioFileMapping::open(const std::string &filePath)
+{
+    close();
+
+#if defined(_WIN32)
+    int pathLength = MultiByteToWideChar(CP_UTF8, 0, filePath.c_str(), -1, NULL, 0);
+    std::wstring widePath(pathLength, 0);
+    MultiByteToWideChar(CP_UTF8, 0, filePath.c_str(), -1, &widePath[0], pathLength);
+
+    fileHandle = CreateFileW(widePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+    {
+        close();
+        return false;
+    }
+
+    mappingHandle = CreateFileMappingW(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mappingHandle == NULL)
+    {
+        close();
+        return false;
+    }
+
+    mappedData = (const uint8_t *)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+    if (mappedData == nullptr)
+    {
+        close();
+        return false;
+    }
+    mappedSize = (size_t)fileSize.QuadPart;
+#else
+    int fd = ::open(filePath.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat fileInfo;
+    if (fstat(fd, &fileInfo) != 0 || fileInfo.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *mapped = mmap(NULL, (size_t)fileInfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+        return false;
+
+    madvise(mapped, (size_t)fileInfo.st_size, MADV_SEQUENTIAL);
+    mappedData = (const uint8_t *)mapped;
+    mappedSize = (size_t)fileInfo.st_size;
+#endif
+
+    return true;
+}
+
+//=============================================================
+inline void AudioFileMapping::close()
+{
+#if defined(_WIN32)
+    if (mappedData != nullptr)
+        UnmapViewOfFile(mappedData);
+    if (mappingHandle != NULL)
+        CloseHandle(mappingHandle);
+    if (fileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(fileHandle);
+    mappingHandle = NULL;
+    fileHandle = INVALID_HANDLE_VALUE;
+#else
+    if (mappedData != nullptr)
+        munmap((void *)mappedData, mappedSize);
+#endif
+
+    mappedData = nullptr;
+    mappedSize = 0;
+}
+
+//=============================================================
+inline WaveContainer WaveChunkHeader::getContainer(const uint8_t *bytes, size_t numBytes)
+{
+    static const uint8_t riffGuid[16] = {0x72, 0x69, 0x66, 0x66, 0x2E, 0x91, 0xCF, 0x11, 0xA5, 0xD6, 0x28, 0xDB, 0x04, 0xC1, 0x00, 0x00};
+    static const uint8_t waveGuid[16] = {0x77, 0x61, 0x76, 0x65, 0xF3, 0xAC, 0xD3, 0x11, 0x8C, 0xD1, 0x00, 0xC0, 0x4F, 0x8E, 0xDB, 0x8A};
+
+    if (numBytes >= 40 && memcmp(bytes, riffGuid, 16) == 0 && memcmp(bytes + 24, waveGuid, 16) == 0)
+        return WaveContainer::Wave64;
+
+    if (numBytes < 12 || memcmp(bytes + 8, "WAVE", 4) != 0)
+        return WaveContainer::None;
+
+    if (memcmp(bytes, "RIFF", 4) == 0)
+        return WaveContainer::Riff;
+
+    if (memcmp(bytes, "RF64", 4) == 0 || memcmp(bytes, "BW64", 4) == 0)
+        return WaveContainer::RF64;
+
+    return WaveContainer::None;
+}
+
+//=============================================================
+inline void WaveChunkHeader::read(const uint8_t *bytes, WaveContainer container)
+{
+    // every registered WAV chunk GUID is its four character code followed by these bytes
+    static const uint8_t guidSuffix[12] = {0xF3, 0xAC, 0xD3, 0x11, 0x8C, 0xD1, 0x00, 0xC0, 0x4F, 0x8E, 0xDB, 0x8A};
+
+    wave64 = container == WaveContainer::Wave64;
+
+    if (wave64)
+    {
+        if (memcmp(bytes + 4, guidSuffix, 12) == 0)
+            memcpy(id, bytes, 4);
+        else
+            memset(id, 0, 4);
+
+        // Wave64 sizes include the header
+        uint64_t chunkSize = readUInt64(bytes + 16);
+        headerSize = 24;
+        bodySize = chunkSize > headerSize ? chunkSize - headerSize : 0;
+    }
+    else
+    {
+        memcpy(id, bytes, 4);
+        headerSize = 8;
+        bodySize = (uint32_t)bytes[4] | ((uint32_t)bytes[5] << 8) | ((uint32_t)bytes[6] << 16) | ((uint32_t)bytes[7] << 24);
+    }
+}
+
+//=============================================================
+inline uint64_t WaveChunkHeader::getNextChunk(uint64_t chunkStart) const
+{
+    // RIFF chunks are padded to an even size, Wave64 chunks to a multiple of 8
+    uint64_t alignment = wave64 ? 8 : 2;
+    uint64_t size = headerSize + bodySize;
+    return chunkStart + (size + alignment - 1) / alignment * alignment;
+}
+
+//=============================================================
+inline uint64_t WaveChunkHeader::readUInt64(const uint8_t *bytes)
+{
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--)
+        value = (value << 8) | bytes[i];
+    return value;
+}
+
+//=============================================================
+template <class T>
+AUDIOFILE_ALWAYS_INLINE void PCMConverter::convert8(const uint8_t *src, size_t srcStride, T *dst, size_t dstStride, size_t numSamples)
+{
+    for (size_t i = 0; i < numSamples; i++)
+        dst[i * dstStride] = static_cast<T>((int)src[i * srcStride] - 128) * static_cast<T>(1. / 128.);
+}
+
+//=============================================================
+template <class T>
+AUDIOFILE_ALWAYS_INLINE void PCMConverter::convert16(const uint8_t *src, size_t srcStride, T *dst, size_t dstStride, size_t numSamples)
+{
+    for (size_t i = 0; i < numSamples; i++)
+    {
+        const uint8_t *bytes = src + i * srcStride;
+        int16_t sampleAsInt = (int16_t)(bytes[0] | (bytes[1] << 8));
+        dst[i * dstStride] = static_cast<T>(sampleAsInt) * static_cast<T>(1. / 32768.);
+    }
+}
+
+//=============================================================
+template <class T>
+AUDIOFILE_ALWAYS_INLINE void PCMConverter::convert24(const uint8_t *src, size_t srcStride, T *dst, size_t dstStride, size_t numSamples)
+{
+    for (size_t i = 0; i < numSamples; i++)
+    {
+        const uint8_t *bytes = src + i * srcStride;
+        // build the sample in the top 24 bits and shift back down, which sign
+        // extends it without a branch
+        int32_t sampleAsInt = (int32_t)(((uint32_t)bytes[2] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[0] << 8)) >> 8;
+        dst[i * dstStride] = static_cast<T>(sampleAsInt) * static_cast<T>(1. / 8388608.);
+    }
+}
+
+//=============================================================
+template <class T>
+AUDIOFILE_ALWAYS_INLINE void PCMConverter::convert32(const uint8_t *src, size_t srcStride, T *dst, size_t dstStride, size_t numSamples)
+{
+    for (size_t i = 0; i < numSamples; i++)
+    {
+        const uint8_t *bytes = src + i * srcStride;
+        int32_t sampleAsInt = (int32_t)((uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24));
+        dst[i * dstStride] = static_cast<T>(sampleAsInt) / static_cast<float>(std::numeric_limits<std::int32_t>::max());
+    }
+}
+
+//=============================================================
+template <class T>
+AUDIOFILE_ALWAYS_INLINE void PCMConverter::convertFloat(const uint8_t *src, size_t srcStride, T *dst, size_t dstStride, size_t numSamples)
+{
+    for (size_t i = 0; i < numSamples; i++)
+    {
+        float sample;
+        memcpy(&sample, src + i * srcStride, sizeof(float));
+        dst[i * dstStride] = static_cast<T>(sample);
+    }
+}
+
+//=============================================================
+template <class T>
+void PCMConverter::convertDefault(const uint8_t *src, size_t srcStride, T *dst, size_t dstStride, size_t numSamples, int bitDepth, bool isFloat)
+{
+    if (bitDepth == 8)
+        convert8(src, srcStride, dst, dstStride, numSamples);
+    else if (bitDepth == 16)
+        convert16(src, srcStride, dst, dstStride, numSamples);
+    else if (bitDepth == 24)
+        convert24(src, srcStride, dst, dstStride, numSamples);
+    else if (isFloat)
+        convertFloat(src, srcStride, dst, dstStride, numSamples);
+    else
+        convert32(src, srcStride, dst, dstStride, numSamples);
+}
+
+#if AUDIOFILE_PCM_DISPATCH
+//=============================================================
+template <class T>
+__attribute__((target("avx2"))) void PCMConverter::convertAVX2(const uint8_t *src, size_t srcStride, T *dst, size_t dstStride, size_t numSamples, int bitDepth, bool isFloat)
+{
+    if (bitDepth == 8)
+        convert8(src, srcStride, dst, dstStride, numSamples);
+    else if (bitDepth == 16)
+        convert16(src, srcStride, dst, dstStride, numSamples);
+    else if (bitDepth == 24)
+        convert24(src, srcStride, dst, dstStride, numSamples);
+    else if (isFloat)
+        convertFloat(src, srcStride, dst, dstStride, numSamples);
+    else
+        convert32(src, srcStride, dst, dstStride, numSamples);
+}
+
+//=============================================================
+inline bool PCMConverter::hasAVX2()
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+#endif
+
+//=============================================================
+template <class T>
+bool PCMConverter::convert(const uint8_t *src, size_t srcStride, T *dst, size_t dstStride, size_t numSamples, int bitDepth, bool isFloat)
+{
+    if (bitDepth != 8 && bitDepth != 16 && bitDepth != 24 && bitDepth != 32)
+        return false;
+
+    if (isFloat && bitDepth != 32)
+        return false;
+
+#if AUDIOFILE_PCM_DISPATCH
+    if (hasAVX2())
+    {
+        convertAVX2(src, srcStride, dst, dstStride, numSamples, bitDepth, isFloat);
+        return true;
+    }
+#endif
+
+    convertDefault(src, srcStride, dst, dstStride, numSamples, bitDepth, isFloat);
+    return true;
+}
+
 //=============================================================
 template <class T>
 AudioFile<T>::AudioFile()
@@ -463,6 +982,17 @@ void AudioFile<T>::shouldLogErrorsToConsole(bool logErrors)
 template <class T>
 bool AudioFile<T>::load(std::string filePath)
 {
+    // WAV files are decoded in place from a mapping of the file
+    {
+        AudioFileMapping mapping;
+
+        if (mapping.open(filePath) && WaveChunkHeader::getContainer(mapping.data(), mapping.size()) != WaveContainer::None)
+        {
+            audioFileFormat = AudioFileFormat::Wave;
+            return decodeWaveFile(mapping.data(), mapping.size());
+        }
+    }
+
     std::ifstream file(filePath, std::ios::binary);
 
     // check the file exists
@@ -520,22 +1050,74 @@ bool AudioFile<T>::loadFromMemory(std::vector<uint8_t> &fileData)
 //=============================================================
 template <class T>
 bool AudioFile<T>::decodeWaveFile(std::vector<uint8_t> &fileData)
+{
+    return decodeWaveFile(fileData.data(), fileData.size());
+}
+
+//=============================================================
+template <class T>
+bool AudioFile<T>::decodeWaveFile(const uint8_t *fileData, size_t fileSize)
 {
     // -----------------------------------------------------------
     // HEADER CHUNK
-    std::string headerChunkID(fileData.begin(), fileData.begin() + 4);
-    // int32_t fileSizeInBytes = fourBytesToInt (fileData, 4) + 8;
-    std::string format(fileData.begin() + 8, fileData.begin() + 12);
+    WaveContainer container = WaveChunkHeader::getContainer(fileData, fileSize);
+
+    if (container == WaveContainer::None)
+    {
+        reportError("ERROR: this doesn't seem to be a valid .WAV file");
+        return false;
+    }
 
     // -----------------------------------------------------------
-    // try and find the start points of key chunks
-    int indexOfDataChunk = getIndexOfChunk(fileData, "data", 12);
-    int indexOfFormatChunk = getIndexOfChunk(fileData, "fmt ", 12);
-    int indexOfXMLChunk = getIndexOfChunk(fileData, "iXML", 12);
+    // walk the chunks to find the start points of key chunks. offsets are
+    // kept 64-bit, since RF64 and Wave64 files can be well over 4GB
+    uint64_t indexOfDataChunk = 0;
+    uint64_t indexOfFormatChunk = 0;
+    uint64_t indexOfXMLChunk = 0;
+    uint64_t dataChunkSize = 0;
+    uint64_t formatChunkSize = 0;
+    uint64_t xmlChunkSize = 0;
+    uint64_t ds64DataSize = 0;
+    uint64_t headerSize = WaveChunkHeader::getHeaderSize(container);
+    uint64_t chunkStart = WaveChunkHeader::getFirstChunk(container);
+
+    while (chunkStart + headerSize <= fileSize)
+    {
+        WaveChunkHeader chunk;
+        chunk.read(fileData + chunkStart, container);
+        uint64_t body = chunkStart + chunk.headerSize;
 
-    // if we can't find the data or format chunks, or the IDs/formats don't seem to be as expected
-    // then it is unlikely we'll able to read this file, so abort
-    if (indexOfDataChunk == -1 || indexOfFormatChunk == -1 || headerChunkID != "RIFF" || format != "WAVE")
+        if (container == WaveContainer::RF64 && chunk.is("ds64") && chunk.bodySize >= 16 && body + 16 <= fileSize)
+            ds64DataSize = WaveChunkHeader::readUInt64(fileData + body + 8);
+        else if (chunk.is("fmt ") && indexOfFormatChunk == 0)
+        {
+            indexOfFormatChunk = body;
+            formatChunkSize = chunk.bodySize;
+        }
+        else if (chunk.is("data") && indexOfDataChunk == 0)
+        {
+            indexOfDataChunk = body;
+            dataChunkSize = chunk.bodySize;
+
+            if (container == WaveContainer::RF64 && dataChunkSize == WaveChunkHeader::rf64SizeMarker)
+                dataChunkSize = ds64DataSize;
+        }
+        else if (chunk.is("iXML") && indexOfXMLChunk == 0)
+        {
+            indexOfXMLChunk = body;
+            xmlChunkSize = chunk.bodySize;
+        }
+
+        // a data chunk that claims to run past the end of the file is the last one
+        if (chunk.bodySize > fileSize - body)
+            break;
+
+        chunkStart = chunk.getNextChunk(chunkStart);
+    }
+
+    // if we can't find the data or format chunks then it is unlikely we'll
+    // able to read this file, so abort
+    if (indexOfDataChunk == 0 || indexOfFormatChunk == 0 || formatChunkSize < 16 || indexOfFormatChunk + 16 > fileSize)
     {
         reportError("ERROR: this doesn't seem to be a valid .WAV file");
         return false;
@@ -543,15 +1125,13 @@ bool AudioFile<T>::decodeWaveFile(std::vector<uint8_t> &fileData)
 
     // -----------------------------------------------------------
     // FORMAT CHUNK
-    int f = indexOfFormatChunk;
-    std::string formatChunkID(fileData.begin() + f, fileData.begin() + f + 4);
-    // int32_t formatChunkSize = fourBytesToInt (fileData, f + 4);
-    uint16_t audioFormat = twoBytesToInt(fileData, f + 8);
-    uint16_t numChannels = twoBytesToInt(fileData, f + 10);
-    sampleRate = (uint32_t)fourBytesToInt(fileData, f + 12);
-    uint32_t numBytesPerSecond = fourBytesToInt(fileData, f + 16);
-    uint16_t numBytesPerBlock = twoBytesToInt(fileData, f + 20);
-    bitDepth = (int)twoBytesToInt(fileData, f + 22);
+    size_t f = indexOfFormatChunk;
+    uint16_t audioFormat = twoBytesToInt(fileData, f);
+    uint16_t numChannels = twoBytesToInt(fileData, f + 2);
+    sampleRate = (uint32_t)fourBytesToInt(fileData, f + 4);
+    uint32_t numBytesPerSecond = fourBytesToInt(fileData, f + 8);
+    uint16_t numBytesPerBlock = twoBytesToInt(fileData, f + 12);
+    bitDepth = (int)twoBytesToInt(fileData, f + 14);
 
     uint16_t numBytesPerSample = static_cast<uint16_t>(bitDepth) / 8;
 
@@ -585,76 +1165,46 @@ bool AudioFile<T>::decodeWaveFile(std::vector<uint8_t> &fileData)
 
     // -----------------------------------------------------------
     // DATA CHUNK
-    int d = indexOfDataChunk;
-    std::string dataChunkID(fileData.begin() + d, fileData.begin() + d + 4);
-    int32_t dataChunkSize = fourBytesToInt(fileData, d + 4);
+    uint64_t numFrames = dataChunkSize / numBytesPerBlock;
+    size_t samplesStartIndex = indexOfDataChunk;
 
-    int numSamples = dataChunkSize / (numChannels * bitDepth / 8);
-    int samplesStartIndex = indexOfDataChunk + 8;
-
-    clearAudioBuffer();
-    samples.resize(numChannels);
-
-    for (int i = 0; i < numSamples; i++)
+    if (samplesStartIndex + numBytesPerBlock * numFrames > fileSize)
     {
-        for (int channel = 0; channel < numChannels; channel++)
-        {
-            int sampleIndex = samplesStartIndex + (numBytesPerBlock * i) + channel * numBytesPerSample;
-
-            if ((sampleIndex + (bitDepth / 8) - 1) >= fileData.size())
-            {
-                reportError("ERROR: read file error as the metadata indicates more samples than there are in the file data");
-                return false;
-            }
+        reportError("ERROR: read file error as the metadata indicates more samples than there are in the file data");
+        return false;
+    }
 
-            if (bitDepth == 8)
-            {
-                T sample = singleByteToSample(fileData[sampleIndex]);
-                samples[channel].push_back(sample);
-            }
-            else if (bitDepth == 16)
-            {
-                int16_t sampleAsInt = twoBytesToInt(fileData, sampleIndex);
-                T sample = sixteenBitIntToSample(sampleAsInt);
-                samples[channel].push_back(sample);
-            }
-            else if (bitDepth == 24)
-            {
-                int32_t sampleAsInt = 0;
-                sampleAsInt = (fileData[sampleIndex + 2] << 16) | (fileData[sampleIndex + 1] << 8) | fileData[sampleIndex];
+    // the buffer holds an int's worth of samples per channel, longer files
+    // have to be read in pieces with AudioFileReader
+    if (numFrames > (uint64_t)std::numeric_limits<int>::max())
+    {
+        reportError("ERROR: this file is too long to load into memory in one go");
+        return false;
+    }
 
-                if (sampleAsInt & 0x800000)                //  if the 24th bit is set, this is a negative number in 24-bit world
-                    sampleAsInt = sampleAsInt | ~0xFFFFFF; // so make sure sign is extended to the 32 bit float
+    int numSamples = (int)numFrames;
 
-                T sample = (T)sampleAsInt / (T)8388608.;
-                samples[channel].push_back(sample);
-            }
-            else if (bitDepth == 32)
-            {
-                int32_t sampleAsInt = fourBytesToInt(fileData, sampleIndex);
-                T sample;
+    clearAudioBuffer();
+    samples.resize(numChannels);
+    for (int channel = 0; channel < numChannels; channel++)
+        samples[channel].resize(numSamples);
 
-                if (audioFormat == WavAudioFormat::IEEEFloat)
-                    sample = (T) reinterpret_cast<float &>(sampleAsInt);
-                else // assume PCM
-                    sample = (T)sampleAsInt / static_cast<float>(std::numeric_limits<std::int32_t>::max());
+    for (int channel = 0; channel < numChannels; channel++)
+    {
+        const uint8_t *channelData = fileData + samplesStartIndex + channel * numBytesPerSample;
+        bool isFloat = audioFormat == WavAudioFormat::IEEEFloat;
 
-                samples[channel].push_back(sample);
-            }
-            else
-            {
-                assert(false);
-            }
+        if (!PCMConverter::convert(channelData, numBytesPerBlock, samples[channel].data(), 1, numSamples, bitDepth, isFloat))
+        {
+            reportError("ERROR: this file has an unsupported bit depth");
+            return false;
         }
     }
 
     // -----------------------------------------------------------
     // iXML CHUNK
-    if (indexOfXMLChunk != -1)
-    {
-        int32_t chunkSize = fourBytesToInt(fileData, indexOfXMLChunk + 4);
-        iXMLChunk = std::string((const char *)&fileData[indexOfXMLChunk + 8], chunkSize);
-    }
+    if (indexOfXMLChunk != 0 && indexOfXMLChunk + xmlChunkSize <= fileSize)
+        iXMLChunk = std::string((const char *)&fileData[indexOfXMLChunk], xmlChunkSize);
 
     return true;
 }
@@ -1174,7 +1724,7 @@ AudioFileFormat AudioFile<T>::determineAudioFileFormat(std::vector<uint8_t> &fil
 {
     std::string header(fileData.begin(), fileData.begin() + 4);
 
-    if (header == "RIFF")
+    if (header == "RIFF" || WaveChunkHeader::getContainer(fileData.data(), fileData.size()) != WaveContainer::None)
         return AudioFileFormat::Wave;
     else if (header == "FORM")
         return AudioFileFormat::Aiff;
@@ -1185,6 +1735,13 @@ AudioFileFormat AudioFile<T>::determineAudioFileFormat(std::vector<uint8_t> &fil
 //=============================================================
 template <class T>
 int32_t AudioFile<T>::fourBytesToInt(std::vector<uint8_t> &source, int startIndex, Endianness endianness)
+{
+    return fourBytesToInt(source.data(), (size_t)startIndex, endianness);
+}
+
+//=============================================================
+template <class T>
+int32_t AudioFile<T>::fourBytesToInt(const uint8_t *source, size_t startIndex, Endianness endianness)
 {
     int32_t result;
 
@@ -1199,6 +1756,13 @@ int32_t AudioFile<T>::fourBytesToInt(std::vector<uint8_t> &source, int startInde
 //=============================================================
 template <class T>
 int16_t AudioFile<T>::twoBytesToInt(std::vector<uint8_t> &source, int startIndex, Endianness endianness)
+{
+    return twoBytesToInt(source.data(), (size_t)startIndex, endianness);
+}
+
+//=============================================================
+template <class T>
+int16_t AudioFile<T>::twoBytesToInt(const uint8_t *source, size_t startIndex, Endianness endianness)
 {
     int16_t result;
 
@@ -1234,6 +1798,13 @@ int AudioFile<T>::getIndexOfString(std::vector<uint8_t> &source, std::string str
 //=============================================================
 template <class T>
 int AudioFile<T>::getIndexOfChunk(std::vector<uint8_t> &source, const std::string &chunkHeaderID, int startIndex, Endianness endianness)
+{
+    return getIndexOfChunk(source.data(), source.size(), chunkHeaderID, startIndex, endianness);
+}
+
+//=============================================================
+template <class T>
+int AudioFile<T>::getIndexOfChunk(const uint8_t *source, size_t sourceSize, const std::string &chunkHeaderID, int startIndex, Endianness endianness)
 {
     constexpr int dataLen = 4;
     if (chunkHeaderID.size() != dataLen)
@@ -1242,16 +1813,16 @@ int AudioFile<T>::getIndexOfChunk(std::vector<uint8_t> &source, const std::strin
         return -1;
     }
 
-    int i = startIndex;
-    while (i < source.size() - dataLen)
+    size_t i = startIndex;
+    while (i + 2 * dataLen <= sourceSize)
     {
         if (memcmp(&source[i], chunkHeaderID.data(), dataLen) == 0)
         {
-            return i;
+            return (int)i;
         }
 
         i += dataLen;
-        auto chunkSize = fourBytesToInt(source, i, endianness);
+        uint32_t chunkSize = (uint32_t)fourBytesToInt(source, i, endianness);
         i += (dataLen + chunkSize);
     }
 
@@ -1306,6 +1877,313 @@ void AudioFile<T>::reportError(std::string errorMessage)
         std::cout << errorMessage << std::endl;
 }
 
+//=============================================================
+template <class T>
+bool AudioFileReader<T>::open(const std::string &filePath)
+{
+    close();
+    file.open(filePath, std::ios::binary);
+    if (!file.good())
+        return false;
+
+    file.seekg(0, std::ios::end);
+    int64_t fileSize = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    uint8_t header[40] = {0};
+    file.read((char *)header, 40);
+    size_t headerBytes = (size_t)file.gcount();
+    file.clear();
+
+    if (headerBytes < 12)
+        return false;
+
+    WaveContainer container = WaveChunkHeader::getContainer(header, headerBytes);
+    bool isAifc = false;
+    if (container != WaveContainer::None)
+        isAiff = false;
+    else if (memcmp(header, "FORM", 4) == 0 && memcmp(header + 8, "AIFF", 4) == 0)
+        isAiff = true;
+    else if (memcmp(header, "FORM", 4) == 0 && memcmp(header + 8, "AIFC", 4) == 0)
+        isAiff = isAifc = true;
+    else
+        return false;
+    bigEndian = isAiff;
+
+    // -----------------------------------------------------------
+    // walk the chunks once to find the format and where the samples are
+    bool foundFormat = false;
+    bool foundData = false;
+    int64_t dataSize = 0;
+    int64_t aiffFrames = 0;
+    uint64_t ds64DataSize = 0;
+    int64_t chunkStart = isAiff ? 12 : (int64_t)WaveChunkHeader::getFirstChunk(container);
+    int headerSize = isAiff ? 8 : WaveChunkHeader::getHeaderSize(container);
+
+    while (chunkStart + headerSize <= fileSize && !(foundFormat && foundData))
+    {
+        uint8_t chunkHeader[24];
+        file.seekg(chunkStart);
+        if (!file.read((char *)chunkHeader, headerSize))
+            break;
+
+        // AIFF chunk headers are laid out like RIFF ones, just big endian
+        WaveChunkHeader chunk;
+        if (isAiff)
+        {
+            memcpy(chunk.id, chunkHeader, 4);
+            chunk.headerSize = 8;
+            chunk.bodySize = readUInt32(chunkHeader + 4, true);
+        }
+        else
+            chunk.read(chunkHeader, container);
+
+        int64_t body = chunkStart + (int64_t)chunk.headerSize;
+        int64_t chunkSize = (int64_t)std::min<uint64_t>(chunk.bodySize, (uint64_t)(fileSize - body));
+
+        if (container == WaveContainer::RF64 && chunk.is("ds64") && chunkSize >= 16)
+        {
+            uint8_t ds64[16];
+            file.read((char *)ds64, 16);
+            ds64DataSize = WaveChunkHeader::readUInt64(ds64 + 8);
+        }
+        else if (!isAiff && chunk.is("fmt ") && chunkSize >= 16)
+        {
+            uint8_t format[40] = {0};
+            file.read((char *)format, std::min<int64_t>(chunkSize, 40));
+            uint16_t audioFormat = readUInt16(format, false);
+            numChannels = readUInt16(format + 2, false);
+            sampleRate = readUInt32(format + 4, false);
+            bitDepth = readUInt16(format + 14, false);
+
+            if (audioFormat == WavAudioFormat::Extensible && chunkSize >= 26)
+                audioFormat = readUInt16(format + 24, false);
+
+            if (audioFormat != WavAudioFormat::PCM && audioFormat != WavAudioFormat::IEEEFloat)
+                return false;
+
+            isFloat = audioFormat == WavAudioFormat::IEEEFloat;
+            foundFormat = true;
+        }
+        else if (!isAiff && chunk.is("data"))
+        {
+            dataStart = body;
+            dataSize = chunkSize;
+
+            if (container == WaveContainer::RF64 && chunk.bodySize == WaveChunkHeader::rf64SizeMarker)
+                dataSize = (int64_t)std::min<uint64_t>(ds64DataSize, (uint64_t)(fileSize - body));
+
+            foundData = true;
+        }
+        else if (isAiff && chunk.is("COMM") && chunkSize >= 18)
+        {
+            uint8_t comm[22] = {0};
+            file.read((char *)comm, std::min<int64_t>(chunkSize, 22));
+            numChannels = readUInt16(comm, true);
+            aiffFrames = readUInt32(comm + 2, true);
+            bitDepth = readUInt16(comm + 6, true);
+            sampleRate = readExtendedSampleRate(comm + 8);
+
+            // AIFC is only supported uncompressed, in either byte order
+            if (isAifc && chunkSize >= 22)
+            {
+                if (memcmp(comm + 18, "sowt", 4) == 0)
+                    bigEndian = false;
+                else if (memcmp(comm + 18, "NONE", 4) != 0)
+                    return false;
+            }
+
+            foundFormat = true;
+        }
+        else if (isAiff && chunk.is("SSND") && chunkSize >= 8)
+        {
+            uint8_t offset[4];
+            file.read((char *)offset, 4);
+            int64_t dataOffset = readUInt32(offset, true);
+            dataStart = body + 8 + dataOffset;
+            dataSize = chunkSize - 8 - dataOffset;
+            foundData = true;
+        }
+
+        // a chunk that claims to run past the end of the file is the last one
+        if (chunk.bodySize > (uint64_t)(fileSize - body))
+            break;
+
+        chunkStart = (int64_t)chunk.getNextChunk((uint64_t)chunkStart);
+    }
+
+    if (!foundFormat || !foundData || numChannels < 1 || sampleRate == 0)
+        return false;
+
+    if (bitDepth != 8 && bitDepth != 16 && bitDepth != 24 && bitDepth != 32)
+        return false;
+
+    if (isFloat && bitDepth != 32)
+        return false;
+
+    bytesPerFrame = numChannels * bitDepth / 8;
+    dataSize = std::min(dataSize, fileSize - dataStart);
+    numFrames = dataSize / bytesPerFrame;
+
+    if (isAiff)
+        numFrames = std::min(numFrames, aiffFrames);
+
+    file.clear();
+    block.resize((size_t)blockFrames * bytesPerFrame);
+    position = 0;
+    filePosition = -1;
+    return numFrames > 0;
+}
+
+//=============================================================
+template <class T>
+void AudioFileReader<T>::close()
+{
+    if (file.is_open())
+        file.close();
+
+    numFrames = 0;
+    position = 0;
+    filePosition = -1;
+}
+
+//=============================================================
+template <class T>
+bool AudioFileReader<T>::seek(int64_t frame)
+{
+    if (frame < 0 || frame > numFrames)
+        return false;
+
+    position = frame;
+    return true;
+}
+
+//=============================================================
+template <class T>
+int AudioFileReader<T>::readFrames(T *dst, int numFramesToRead)
+{
+    int framesRead = 0;
+    int bytesPerSample = bitDepth / 8;
+
+    while (framesRead < numFramesToRead && position < numFrames)
+    {
+        int frames = (int)std::min<int64_t>({(int64_t)(numFramesToRead - framesRead), (int64_t)blockFrames, numFrames - position});
+
+        // only seek when the last read didn't leave the file where we want it
+        if (filePosition != position)
+            file.seekg(dataStart + position * bytesPerFrame);
+
+        file.read((char *)block.data(), (std::streamsize)frames * bytesPerFrame);
+        frames = (int)(file.gcount() / bytesPerFrame);
+
+        if (frames == 0)
+        {
+            file.clear();
+            filePosition = -1;
+            break;
+        }
+
+        // the bulk kernels only know little endian data, and 8-bit AIFF is signed
+        if (bigEndian || (isAiff && bitDepth == 8))
+        {
+            const uint8_t *bytes = block.data();
+            for (int i = 0; i < frames * numChannels; i++)
+            {
+                *dst++ = decodeSample(bytes);
+                bytes += bytesPerSample;
+            }
+        }
+        else
+        {
+            for (int channel = 0; channel < numChannels; channel++)
+                PCMConverter::convert(block.data() + channel * bytesPerSample, bytesPerFrame, dst + channel, numChannels, frames, bitDepth, isFloat);
+
+            dst += frames * numChannels;
+        }
+
+        framesRead += frames;
+        position += frames;
+        filePosition = position;
+    }
+
+    return framesRead;
+}
+
+//=============================================================
+template <class T>
+uint32_t AudioFileReader<T>::readUInt32(const uint8_t *bytes, bool bigEndian)
+{
+    if (bigEndian)
+        return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+    else
+        return ((uint32_t)bytes[3] << 24) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[1] << 8) | bytes[0];
+}
+
+//=============================================================
+template <class T>
+uint16_t AudioFileReader<T>::readUInt16(const uint8_t *bytes, bool bigEndian)
+{
+    if (bigEndian)
+        return (uint16_t)((bytes[0] << 8) | bytes[1]);
+    else
+        return (uint16_t)((bytes[1] << 8) | bytes[0]);
+}
+
+//=============================================================
+template <class T>
+uint32_t AudioFileReader<T>::readExtendedSampleRate(const uint8_t *bytes)
+{
+    // AIFF stores its sample rate as an 80 bit extended precision float
+    int exponent = ((bytes[0] & 0x7F) << 8) | bytes[1];
+    uint64_t mantissa = 0;
+
+    for (int i = 0; i < 8; i++)
+        mantissa = (mantissa << 8) | bytes[2 + i];
+
+    return (uint32_t)std::ldexp((double)mantissa, exponent - 16383 - 63);
+}
+
+//=============================================================
+template <class T>
+T AudioFileReader<T>::decodeSample(const uint8_t *bytes) const
+{
+    if (bitDepth == 8)
+    {
+        // 8-bit WAV is unsigned, 8-bit AIFF is signed
+        if (isAiff)
+            return static_cast<T>((int8_t)bytes[0]) / static_cast<T>(128.);
+        else
+            return static_cast<T>(bytes[0] - 128) / static_cast<T>(128.);
+    }
+    else if (bitDepth == 16)
+    {
+        return static_cast<T>((int16_t)readUInt16(bytes, bigEndian)) / static_cast<T>(32768.);
+    }
+    else if (bitDepth == 24)
+    {
+        int32_t sampleAsInt = bigEndian ? (bytes[0] << 16) | (bytes[1] << 8) | bytes[2]
+                                        : (bytes[2] << 16) | (bytes[1] << 8) | bytes[0];
+
+        if (sampleAsInt & 0x800000)
+            sampleAsInt = sampleAsInt | ~0xFFFFFF;
+
+        return static_cast<T>(sampleAsInt) / static_cast<T>(8388608.);
+    }
+    else
+    {
+        uint32_t sampleAsInt = readUInt32(bytes, bigEndian);
+
+        if (isFloat)
+        {
+            float sample;
+            memcpy(&sample, &sampleAsInt, sizeof(float));
+            return static_cast<T>(sample);
+        }
+
+        return static_cast<T>((int32_t)sampleAsInt) / static_cast<T>(std::numeric_limits<std::int32_t>::max());
+    }
+}
+
 #if defined(_MSC_VER)
 __pragma(warning(pop))
 #elif defined(__GNUC__)
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cmath>
+
+// CrossfadeTable holds an equal power fade curve, so loop crossfades cost a
+// table lookup per voice instead of a sin and a cos. the fade out is the same
+// curve read backwards
+
+#define CROSSFADE_TABLE_SIZE 1024
+
+struct CrossfadeTable
+{
+  float gains[CROSSFADE_TABLE_SIZE + 1];
+
+  CrossfadeTable()
+  {
+    for (int i = 0; i <= CROSSFADE_TABLE_SIZE; i++)
+    {
+      gains[i] = std::sin(0.5 * M_PI * i / CROSSFADE_TABLE_SIZE);
+    }
+  }
+
+  // gain of the incoming side, x goes from 0 to 1 over the fade
+  float fade_in(float x) const
+  {
+    float index = std::fmin(std::fmax(x, 0.f), 1.f) * CROSSFADE_TABLE_SIZE;
+    int i = std::fmin((int)index, CROSSFADE_TABLE_SIZE - 1);
+    float frac = index - i;
+    return gains[i] + (gains[i + 1] - gains[i]) * frac;
+  }
+
+  float fade_out(float x) const
+  {
+    return fade_in(1.f - x);
+  }
+};
+
+inline const CrossfadeTable &crossfade_table()
+{
+  static const CrossfadeTable table;
+  return table;
+}
@@ -0,0 +1,790 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "SampleBuffer.hpp"
+
+// FlacDecoder reads a whole flac file into a SampleBuffer. the compressed
+// file is read into memory in one go, then split into byte ranges that are
+// decoded on a thread each. a range starts on the first frame past its
+// boundary whose crc checks out, and every frame carries its own sample
+// number, so the threads can write straight into their part of the buffer.
+// integer streams of up to 24 bits are supported, which is everything
+// encoders write by default
+
+#define FLAC_MAX_CHANNELS 8
+#define FLAC_MAX_WORKERS 8
+// ranges smaller than this aren't worth a thread of their own
+#define FLAC_MIN_WORKER_BYTES (1 << 20)
+// the smallest a frame can be: the header, a crc-16 and at least a byte
+// for each channel's subframe on top of this
+#define FLAC_MIN_FRAME_BYTES 8
+// longest stream that's loaded, in samples over all channels. 2 GB of
+// floats, about 45 minutes of stereo at 96k
+#define FLAC_MAX_SAMPLES ((int64_t)1 << 29)
+
+struct FlacBitReader
+{
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+  size_t byte_pos = 0;
+  // the next bits of the stream, left aligned
+  uint64_t cache = 0;
+  int cache_bits = 0;
+
+  FlacBitReader(const uint8_t *data, size_t size, size_t start) : data(data), size(size), byte_pos(start) {}
+
+  void refill()
+  {
+    while (cache_bits <= 56)
+    {
+      uint64_t byte = byte_pos < size ? data[byte_pos] : 0;
+      cache |= byte << (56 - cache_bits);
+      byte_pos++;
+      cache_bits += 8;
+    }
+  }
+
+  // bytes consumed so far, counted from the start of the data
+  size_t position() const
+  {
+    return byte_pos - cache_bits / 8;
+  }
+
+  // true once more has been read than there is data
+  bool overrun() const
+  {
+    return byte_pos * 8 - cache_bits > size * 8;
+  }
+
+  uint32_t read(int bits)
+  {
+    if (bits == 0)
+    {
+      return 0;
+    }
+    refill();
+    uint32_t value = (uint32_t)(cache >> (64 - bits));
+    cache <<= bits;
+    cache_bits -= bits;
+    return value;
+  }
+
+  int32_t read_signed(int bits)
+  {
+    if (bits == 0)
+    {
+      return 0;
+    }
+    uint32_t value = read(bits) << (32 - bits);
+    return (int32_t)value >> (32 - bits);
+  }
+
+  // counts zero bits up to the next one
+  uint32_t read_unary()
+  {
+    uint32_t count = 0;
+    while (true)
+    {
+      refill();
+      if (cache == 0)
+      {
+        count += cache_bits;
+        cache_bits = 0;
+        if (byte_pos > size + 8)
+        {
+          return 0;
+        }
+        continue;
+      }
+      int zeros = __builtin_clzll(cache);
+      count += zeros;
+      cache <<= zeros;
+      cache <<= 1;
+      cache_bits -= zeros + 1;
+      return count;
+    }
+  }
+
+  void align()
+  {
+    int skip = cache_bits % 8;
+    cache <<= skip;
+    cache_bits -= skip;
+  }
+};
+
+struct FlacDecoder
+{
+  struct FrameHeader
+  {
+    int64_t first_sample = 0;
+    int block_size = 0;
+    int channel_mode = 0;
+    int bits_per_sample = 0;
+  };
+
+  int num_channels = 0;
+  int sample_rate = 0;
+  int bits_per_sample = 0;
+  int min_block_size = 0;
+  int max_block_size = 0;
+  // false if the stream info's block sizes can't be trusted, see read_frame_header
+  bool block_sizes_known = true;
+  int64_t total_frames = 0;
+  // streams longer than this are turned down rather than allocated
+  int64_t max_samples = FLAC_MAX_SAMPLES;
+
+  std::vector<uint8_t> file;
+  size_t first_frame = 0;
+
+  // checks the start of a file for the flac marker, past an id3 tag if
+  // there is one
+  static bool is_flac(const std::string &path)
+  {
+    std::ifstream in(path, std::ios::binary);
+    uint8_t header[10] = {0};
+    if (!in.read((char *)header, 10))
+    {
+      return false;
+    }
+    size_t start = id3_size(header);
+    in.seekg(start);
+    char marker[4] = {0};
+    return in.read(marker, 4) && memcmp(marker, "fLaC", 4) == 0;
+  }
+
+  static size_t id3_size(const uint8_t *header)
+  {
+    if (memcmp(header, "ID3", 3) != 0)
+    {
+      return 0;
+    }
+    size_t size = ((header[6] & 0x7f) << 21) | ((header[7] & 0x7f) << 14) | ((header[8] & 0x7f) << 7) | (header[9] & 0x7f);
+    // a footer adds another 10 bytes
+    return 10 + size + (header[5] & 0x10 ? 10 : 0);
+  }
+
+  // decodes the file at path into buffer, scaled to -1 to 1. progress goes
+  // from 0 to 1 as the frames are decoded
+  bool load(const std::string &path, SampleBuffer &buffer, std::atomic<float> *progress)
+  {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.good())
+    {
+      return false;
+    }
+    in.seekg(0, std::ios::end);
+    file.resize((size_t)in.tellg());
+    in.seekg(0, std::ios::beg);
+    if (!in.read((char *)file.data(), file.size()) || !read_metadata())
+    {
+      return false;
+    }
+    if (total_frames == 0 || !block_sizes_known)
+    {
+      return decode_unknown_length(buffer);
+    }
+
+    buffer.allocate(num_channels, total_frames);
+
+    // split the frames into ranges, each starting on a frame that decodes
+    int workers = (int)std::min<size_t>({(size_t)std::max(1u, std::thread::hardware_concurrency()),
+                                         (size_t)FLAC_MAX_WORKERS,
+                                         (file.size() - first_frame) / FLAC_MIN_WORKER_BYTES + 1});
+    std::vector<size_t> starts = {first_frame};
+    {
+      std::vector<std::vector<int32_t>> scratch = make_scratch();
+      for (int i = 1; i < workers; i++)
+      {
+        size_t boundary = first_frame + (file.size() - first_frame) * i / workers;
+        size_t start = find_frame(std::max(boundary, starts.back() + 1), scratch);
+        if (start < file.size())
+        {
+          starts.push_back(start);
+        }
+      }
+    }
+    starts.push_back(file.size());
+
+    std::atomic<size_t> bytes_done{0};
+    std::atomic<int> workers_done{0};
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i + 1 < starts.size(); i++)
+    {
+      threads.emplace_back([&, i]()
+                           {
+                             decode_range(starts[i], starts[i + 1], buffer, &bytes_done);
+                             workers_done++; });
+    }
+    size_t bytes_total = file.size() - first_frame;
+    while (progress && workers_done < (int)threads.size())
+    {
+      *progress = (float)bytes_done / (float)bytes_total;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    for (std::thread &thread : threads)
+    {
+      thread.join();
+    }
+    file.clear();
+    file.shrink_to_fit();
+    return true;
+  }
+
+  bool read_metadata()
+  {
+    if (file.size() < 10)
+    {
+      return false;
+    }
+    size_t pos = id3_size(file.data());
+    if (pos + 4 > file.size() || memcmp(file.data() + pos, "fLaC", 4) != 0)
+    {
+      return false;
+    }
+    pos += 4;
+
+    bool found_info = false;
+    bool last = false;
+    while (!last && pos + 4 <= file.size())
+    {
+      const uint8_t *block = file.data() + pos;
+      last = block[0] & 0x80;
+      int type = block[0] & 0x7f;
+      size_t length = (block[1] << 16) | (block[2] << 8) | block[3];
+      pos += 4;
+      if (pos + length > file.size())
+      {
+        return false;
+      }
+      if (type == 0 && length >= 34)
+      {
+        FlacBitReader bits(file.data(), file.size(), pos);
+        min_block_size = bits.read(16);
+        max_block_size = bits.read(16);
+        bits.read(24);
+        bits.read(24);
+        sample_rate = bits.read(20);
+        num_channels = bits.read(3) + 1;
+        bits_per_sample = bits.read(5) + 1;
+        int64_t frames_high = bits.read(4);
+        int64_t frames_low = bits.read(32);
+        total_frames = (frames_high << 32) | frames_low;
+        found_info = true;
+      }
+      pos += length;
+    }
+    first_frame = pos;
+
+    if (!found_info || sample_rate == 0 || bits_per_sample < 4 || bits_per_sample > 24)
+    {
+      return false;
+    }
+    if (max_block_size < 16 || min_block_size > max_block_size)
+    {
+      max_block_size = 65535;
+      block_sizes_known = false;
+    }
+    // a length the frames left in the file couldn't hold means the stream
+    // info is damaged, so the frames are counted as they decode instead
+    int64_t most_frames = (int64_t)((file.size() - first_frame) / (FLAC_MIN_FRAME_BYTES + num_channels) + 1) * max_block_size;
+    if (total_frames > most_frames)
+    {
+      total_frames = 0;
+    }
+    return total_frames * num_channels <= max_samples;
+  }
+
+  std::vector<std::vector<int32_t>> make_scratch() const
+  {
+    return std::vector<std::vector<int32_t>>(num_channels, std::vector<int32_t>(max_block_size));
+  }
+
+  // first position at or after start where a frame decodes with a valid crc,
+  // or the end of the file
+  size_t find_frame(size_t start, std::vector<std::vector<int32_t>> &scratch) const
+  {
+    FrameHeader header;
+    size_t next;
+    for (size_t pos = start; pos + 2 <= file.size(); pos++)
+    {
+      if (file[pos] == 0xff && (file[pos + 1] & 0xfe) == 0xf8 && decode_frame(pos, scratch, header, next))
+      {
+        return pos;
+      }
+    }
+    return file.size();
+  }
+
+  void decode_range(size_t start, size_t end, SampleBuffer &buffer, std::atomic<size_t> *bytes_done) const
+  {
+    std::vector<std::vector<int32_t>> scratch = make_scratch();
+    float scale = 1.f / (float)(1 << (bits_per_sample - 1));
+    FrameHeader header;
+    size_t pos = start;
+    while (pos < end)
+    {
+      size_t next;
+      if (!decode_frame(pos, scratch, header, next))
+      {
+        // skip a damaged frame and carry on from the next one that's whole
+        next = find_frame(pos + 1, scratch);
+        *bytes_done += next - pos;
+        pos = next;
+        continue;
+      }
+      int64_t frames = std::min<int64_t>(header.block_size, total_frames - header.first_sample);
+      for (int c = 0; c < num_channels; c++)
+      {
+        float *out = buffer.channel(c) + header.first_sample;
+        const int32_t *in = scratch[c].data();
+        for (int64_t i = 0; i < frames; i++)
+        {
+          out[i] = (float)in[i] * scale;
+        }
+      }
+      *bytes_done += next - pos;
+      pos = next;
+    }
+  }
+
+  // streams that don't say how long they are, or how big their blocks are,
+  // get decoded in order into growing buffers, then copied over
+  bool decode_unknown_length(SampleBuffer &buffer)
+  {
+    std::vector<std::vector<int32_t>> scratch = make_scratch();
+    std::vector<std::vector<float>> channels(num_channels);
+    float scale = 1.f / (float)(1 << (bits_per_sample - 1));
+    FrameHeader header;
+    size_t pos = find_frame(first_frame, scratch);
+    while (pos < file.size())
+    {
+      size_t next;
+      if (!decode_frame(pos, scratch, header, next))
+      {
+        pos = find_frame(pos + 1, scratch);
+        continue;
+      }
+      if ((int64_t)(channels[0].size() + header.block_size) * num_channels > max_samples)
+      {
+        return false;
+      }
+      for (int c = 0; c < num_channels; c++)
+      {
+        for (int i = 0; i < header.block_size; i++)
+        {
+          channels[c].push_back((float)scratch[c][i] * scale);
+        }
+      }
+      pos = next;
+    }
+    total_frames = channels[0].size();
+    if (total_frames == 0)
+    {
+      return false;
+    }
+    buffer.allocate(num_channels, total_frames);
+    for (int c = 0; c < num_channels; c++)
+    {
+      std::copy(channels[c].begin(), channels[c].end(), buffer.channel(c));
+    }
+    file.clear();
+    return true;
+  }
+
+  // decodes the frame at pos into scratch. next is set to the byte after
+  // the frame. fails on anything malformed, including a crc mismatch
+  bool decode_frame(size_t pos, std::vector<std::vector<int32_t>> &scratch, FrameHeader &header, size_t &next) const
+  {
+    FlacBitReader bits(file.data(), file.size(), pos);
+    if (!read_frame_header(bits, header))
+    {
+      return false;
+    }
+    size_t header_end = bits.position();
+    if (crc8(file.data() + pos, header_end - pos - 1) != file[header_end - 1])
+    {
+      return false;
+    }
+
+    for (int c = 0; c < num_channels; c++)
+    {
+      // the side channel needs an extra bit
+      bool side = (header.channel_mode == 8 && c == 1) || (header.channel_mode == 9 && c == 0) || (header.channel_mode == 10 && c == 1);
+      if (!decode_subframe(bits, scratch[c].data(), header.block_size, header.bits_per_sample + side))
+      {
+        return false;
+      }
+    }
+    bits.align();
+    size_t crc_start = bits.position();
+    uint32_t crc = bits.read(16);
+    if (bits.overrun() || crc16(file.data() + pos, crc_start - pos) != crc)
+    {
+      return false;
+    }
+    next = bits.position();
+
+    int32_t *a = scratch[0].data();
+    int32_t *b = num_channels > 1 ? scratch[1].data() : nullptr;
+    int n = header.block_size;
+    if (header.channel_mode == 8)
+    {
+      // left, side
+      for (int i = 0; i < n; i++)
+      {
+        b[i] = a[i] - b[i];
+      }
+    }
+    else if (header.channel_mode == 9)
+    {
+      // side, right
+      for (int i = 0; i < n; i++)
+      {
+        a[i] += b[i];
+      }
+    }
+    else if (header.channel_mode == 10)
+    {
+      // mid, side
+      for (int i = 0; i < n; i++)
+      {
+        int32_t mid = (int32_t)((uint32_t)a[i] << 1) | (b[i] & 1);
+        int32_t side = b[i];
+        a[i] = (mid + side) >> 1;
+        b[i] = (mid - side) >> 1;
+      }
+    }
+    return true;
+  }
+
+  bool read_frame_header(FlacBitReader &bits, FrameHeader &header) const
+  {
+    if (bits.read(14) != 0x3ffe || bits.read(1) != 0)
+    {
+      return false;
+    }
+    bool variable_blocks = bits.read(1);
+    int block_code = bits.read(4);
+    int rate_code = bits.read(4);
+    int channel_code = bits.read(4);
+    int size_code = bits.read(3);
+    if (bits.read(1) != 0 || block_code == 0 || rate_code == 15)
+    {
+      return false;
+    }
+
+    // frame or sample number, utf-8 style
+    uint32_t first = bits.read(8);
+    int extra = 0;
+    while (extra < 8 && (first & (0x80 >> extra)))
+    {
+      extra++;
+    }
+    if (extra == 1 || extra == 8)
+    {
+      return false;
+    }
+    int64_t number = first & (0x7f >> extra);
+    for (int i = 1; i < extra; i++)
+    {
+      uint32_t byte = bits.read(8);
+      if ((byte & 0xc0) != 0x80)
+      {
+        return false;
+      }
+      number = (number << 6) | (byte & 0x3f);
+    }
+
+    if (block_code == 1)
+    {
+      header.block_size = 192;
+    }
+    else if (block_code <= 5)
+    {
+      header.block_size = 576 << (block_code - 2);
+    }
+    else if (block_code == 6)
+    {
+      header.block_size = bits.read(8) + 1;
+    }
+    else if (block_code == 7)
+    {
+      header.block_size = bits.read(16) + 1;
+    }
+    else
+    {
+      header.block_size = 256 << (block_code - 8);
+    }
+
+    // the rate is only ever taken from the stream info, but its bytes have
+    // to be skipped
+    if (rate_code == 12)
+    {
+      bits.read(8);
+    }
+    else if (rate_code == 13 || rate_code == 14)
+    {
+      bits.read(16);
+    }
+    bits.read(8);
+
+    static const int sizes[8] = {0, 8, 12, 0, 16, 20, 24, 0};
+    header.bits_per_sample = size_code == 0 ? bits_per_sample : sizes[size_code];
+    header.channel_mode = channel_code;
+    int channels = channel_code < 8 ? channel_code + 1 : 2;
+    // fixed size blocks only carry their index, which is no use without the
+    // block size from the stream info. decode_unknown_length places those
+    // by the frames before them instead
+    if (variable_blocks)
+    {
+      header.first_sample = number;
+    }
+    else
+    {
+      header.first_sample = block_sizes_known ? number * max_block_size : -1;
+    }
+
+    return header.bits_per_sample == bits_per_sample && channel_code <= 10 && channels == num_channels &&
+           header.block_size <= max_block_size && (total_frames == 0 || header.first_sample < total_frames);
+  }
+
+  bool decode_subframe(FlacBitReader &bits, int32_t *out, int n, int bps) const
+  {
+    if (bits.read(1) != 0)
+    {
+      return false;
+    }
+    int type = bits.read(6);
+    int wasted = 0;
+    if (bits.read(1))
+    {
+      wasted = bits.read_unary() + 1;
+      if (wasted >= bps)
+      {
+        return false;
+      }
+      bps -= wasted;
+    }
+
+    if (type == 0)
+    {
+      int32_t value = bits.read_signed(bps);
+      std::fill(out, out + n, value);
+    }
+    else if (type == 1)
+    {
+      for (int i = 0; i < n; i++)
+      {
+        out[i] = bits.read_signed(bps);
+      }
+    }
+    else if (type >= 8 && type <= 12)
+    {
+      if (!decode_fixed(bits, out, n, bps, type - 8))
+      {
+        return false;
+      }
+    }
+    else if (type >= 32)
+    {
+      if (!decode_lpc(bits, out, n, bps, type - 31))
+      {
+        return false;
+      }
+    }
+    else
+    {
+      return false;
+    }
+
+    if (wasted > 0)
+    {
+      for (int i = 0; i < n; i++)
+      {
+        out[i] = (int32_t)((uint32_t)out[i] << wasted);
+      }
+    }
+    return !bits.overrun();
+  }
+
+  bool decode_fixed(FlacBitReader &bits, int32_t *out, int n, int bps, int order) const
+  {
+    if (order > n)
+    {
+      return false;
+    }
+    for (int i = 0; i < order; i++)
+    {
+      out[i] = bits.read_signed(bps);
+    }
+    if (!decode_residual(bits, out, n, order))
+    {
+      return false;
+    }
+    for (int i = order; i < n; i++)
+    {
+      int64_t prediction = 0;
+      switch (order)
+      {
+      case 1:
+        prediction = out[i - 1];
+        break;
+      case 2:
+        prediction = 2 * (int64_t)out[i - 1] - out[i - 2];
+        break;
+      case 3:
+        prediction = 3 * ((int64_t)out[i - 1] - out[i - 2]) + out[i - 3];
+        break;
+      case 4:
+        prediction = 4 * ((int64_t)out[i - 1] + out[i - 3]) - 6 * (int64_t)out[i - 2] - out[i - 4];
+        break;
+      }
+      out[i] += (int32_t)prediction;
+    }
+    return true;
+  }
+
+  bool decode_lpc(FlacBitReader &bits, int32_t *out, int n, int bps, int order) const
+  {
+    if (order > n)
+    {
+      return false;
+    }
+    for (int i = 0; i < order; i++)
+    {
+      out[i] = bits.read_signed(bps);
+    }
+    int precision = bits.read(4) + 1;
+    int shift = bits.read_signed(5);
+    if (precision == 16 || shift < 0)
+    {
+      return false;
+    }
+    int32_t coefs[32];
+    for (int i = 0; i < order; i++)
+    {
+      coefs[i] = bits.read_signed(precision);
+    }
+    if (!decode_residual(bits, out, n, order))
+    {
+      return false;
+    }
+    for (int i = order; i < n; i++)
+    {
+      int64_t sum = 0;
+      const int32_t *history = out + i - 1;
+      for (int j = 0; j < order; j++)
+      {
+        sum += (int64_t)coefs[j] * history[-j];
+      }
+      out[i] += (int32_t)(sum >> shift);
+    }
+    return true;
+  }
+
+  // rice coded residual, written after the warm up samples
+  bool decode_residual(FlacBitReader &bits, int32_t *out, int n, int order) const
+  {
+    int method = bits.read(2);
+    if (method > 1)
+    {
+      return false;
+    }
+    int param_bits = method == 0 ? 4 : 5;
+    uint32_t escape = method == 0 ? 15 : 31;
+    int partition_order = bits.read(4);
+    int partitions = 1 << partition_order;
+    int partition_size = n >> partition_order;
+    if ((partition_size << partition_order) != n || partition_size < order)
+    {
+      return false;
+    }
+
+    int i = order;
+    for (int p = 0; p < partitions; p++)
+    {
+      int end = (p + 1) * partition_size;
+      uint32_t param = bits.read(param_bits);
+      if (param == escape)
+      {
+        int raw_bits = bits.read(5);
+        for (; i < end; i++)
+        {
+          out[i] = bits.read_signed(raw_bits);
+        }
+        continue;
+      }
+      for (; i < end; i++)
+      {
+        uint32_t quotient = bits.read_unary();
+        uint32_t remainder = bits.read(param);
+        uint32_t value = (quotient << param) | remainder;
+        out[i] = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+      }
+      if (bits.overrun())
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  struct CrcTables
+  {
+    uint8_t crc8[256];
+    uint16_t crc16[256];
+
+    CrcTables()
+    {
+      for (int i = 0; i < 256; i++)
+      {
+        uint8_t c8 = i;
+        uint16_t c16 = i << 8;
+        for (int b = 0; b < 8; b++)
+        {
+          c8 = (c8 & 0x80) ? (c8 << 1) ^ 0x07 : c8 << 1;
+          c16 = (c16 & 0x8000) ? (c16 << 1) ^ 0x8005 : c16 << 1;
+        }
+        crc8[i] = c8;
+        crc16[i] = c16;
+      }
+    }
+  };
+
+  static const CrcTables &crc_tables()
+  {
+    static const CrcTables tables;
+    return tables;
+  }
+
+  static uint8_t crc8(const uint8_t *data, size_t length)
+  {
+    const CrcTables &tables = crc_tables();
+    uint8_t crc = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+      crc = tables.crc8[crc ^ data[i]];
+    }
+    return crc;
+  }
+
+  static uint16_t crc16(const uint8_t *data, size_t length)
+  {
+    const CrcTables &tables = crc_tables();
+    uint16_t crc = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+      crc = (uint16_t)(crc << 8) ^ tables.crc16[(crc >> 8) ^ data[i]];
+    }
+    return crc;
+  }
+};
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <rack.hpp>
+
+// fractional read helpers for playing a sample buffer back at any speed.
+// reads outside of the buffer are treated as silence, so voices can be read
+// right up to either end without any special casing
+
+#define SINC_TAPS 16
+#define SINC_PHASES 256
+// reads faster than one frame per sample widen the sinc kernel to lower its
+// cutoff, up to this many times, so a voice pitched far up has a bounded cost
+#define SINC_MAX_STRETCH 4.f
+
+using namespace rack;
+
+enum InterpolationMode
+{
+  INTERPOLATION_LINEAR,
+  INTERPOLATION_CUBIC,
+  INTERPOLATION_SINC,
+  INTERPOLATION_MODES_LEN
+};
+
+// blackman windowed sinc kernel, one row of taps per fractional phase with an
+// extra row at the end so the phases can be crossfaded without wrapping
+struct SincTable
+{
+  float taps[SINC_PHASES + 1][SINC_TAPS];
+  // the same kernel from its centre out, SINC_PHASES points per zero
+  // crossing, for reading it stretched
+  float curve[SINC_TAPS / 2 * SINC_PHASES + 1];
+
+  SincTable()
+  {
+    for (int p = 0; p <= SINC_PHASES; p++)
+    {
+      float frac = (float)p / SINC_PHASES;
+      float sum = 0.f;
+      for (int t = 0; t < SINC_TAPS; t++)
+      {
+        float x = (float)(t - SINC_TAPS / 2 + 1) - frac;
+        float w = (x + SINC_TAPS / 2.f) / SINC_TAPS;
+        float window = 0.42f - 0.5f * std::cos(2.f * M_PI * w) + 0.08f * std::cos(4.f * M_PI * w);
+        taps[p][t] = x == 0.f ? 1.f : window * std::sin(M_PI * x) / (M_PI * x);
+        sum += taps[p][t];
+      }
+      for (int t = 0; t < SINC_TAPS; t++)
+      {
+        taps[p][t] /= sum;
+      }
+    }
+    for (int i = 0; i <= SINC_TAPS / 2 * SINC_PHASES; i++)
+    {
+      float x = (float)i / SINC_PHASES;
+      float window = 0.42f + 0.5f * std::cos(2.f * M_PI * x / SINC_TAPS) + 0.08f * std::cos(4.f * M_PI * x / SINC_TAPS);
+      curve[i] = i == 0 ? 1.f : window * std::sin(M_PI * x) / (M_PI * x);
+    }
+  }
+
+  static const SincTable &get()
+  {
+    static const SincTable table;
+    return table;
+  }
+};
+
+struct Interpolator
+{
+  static float at(const float *data, int64_t length, int64_t index)
+  {
+    return index >= 0 && index < length ? data[index] : 0.f;
+  }
+
+  static float linear(const float *data, int64_t length, int64_t index, float frac)
+  {
+    float a = at(data, length, index);
+    float b = at(data, length, index + 1);
+    return a + (b - a) * frac;
+  }
+
+  // 4 point, 3rd order hermite
+  static float cubic(const float *data, int64_t length, int64_t index, float frac)
+  {
+    float xm1 = at(data, length, index - 1);
+    float x0 = at(data, length, index);
+    float x1 = at(data, length, index + 1);
+    float x2 = at(data, length, index + 2);
+    float c1 = 0.5f * (x1 - xm1);
+    float c2 = xm1 - 2.5f * x0 + 2.f * x1 - 0.5f * x2;
+    float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+    return ((c3 * frac + c2) * frac + c1) * frac + x0;
+  }
+
+  static float sinc(const float *data, int64_t length, int64_t index, float frac)
+  {
+    const SincTable &table = SincTable::get();
+    float p = frac * SINC_PHASES;
+    int phase = std::min((int)p, SINC_PHASES - 1);
+    float blend = p - phase;
+    const float *a = table.taps[phase];
+    const float *b = table.taps[phase + 1];
+    int64_t start = index - SINC_TAPS / 2 + 1;
+    float out = 0.f;
+    if (start >= 0 && start + SINC_TAPS <= length)
+    {
+      for (int t = 0; t < SINC_TAPS; t++)
+      {
+        out += data[start + t] * (a[t] + (b[t] - a[t]) * blend);
+      }
+    }
+    else
+    {
+      for (int t = 0; t < SINC_TAPS; t++)
+      {
+        out += at(data, length, start + t) * (a[t] + (b[t] - a[t]) * blend);
+      }
+    }
+    return out;
+  }
+
+  // sinc with its cutoff lowered to 1 / stretch, for reading more than one
+  // frame per sample without aliasing. the kernel spans stretch times as
+  // many frames, and is normalized as it goes since its taps no longer fall
+  // on the points the table was made for
+  static float sinc_stretched(const float *data, int64_t length, int64_t index, float frac, float stretch)
+  {
+    const SincTable &table = SincTable::get();
+    const int last_point = SINC_TAPS / 2 * SINC_PHASES - 1;
+    float half = SINC_TAPS / 2 * stretch;
+    int64_t first = (int64_t)std::floor(frac - half) + 1;
+    int64_t last = (int64_t)std::ceil(frac + half) - 1;
+    // position in the curve table, moving by the cutoff every tap
+    float increment = SINC_PHASES / stretch;
+    float position = ((float)first - frac) * increment;
+    bool inside = index + first >= 0 && index + last < length;
+    float out = 0.f;
+    float sum = 0.f;
+    for (int64_t k = first; k <= last; k++, position += increment)
+    {
+      float p = std::fabs(position);
+      int i = std::min((int)p, last_point);
+      float weight = table.curve[i] + (table.curve[i + 1] - table.curve[i]) * (p - i);
+      out += (inside ? data[index + k] : at(data, length, index + k)) * weight;
+      sum += weight;
+    }
+    return sum != 0.f ? out / sum : 0.f;
+  }
+
+  // step is how many frames the read moves per sample, only sinc uses it
+  static float read(int mode, const float *data, int64_t length, double position, double step = 1.0)
+  {
+    int64_t index = (int64_t)position;
+    float frac = (float)(position - (double)index);
+    switch (mode)
+    {
+    case INTERPOLATION_LINEAR:
+      return linear(data, length, index, frac);
+    case INTERPOLATION_SINC:
+      if (step > 1.0)
+      {
+        return sinc_stretched(data, length, index, frac, std::min((float)step, SINC_MAX_STRETCH));
+      }
+      return sinc(data, length, index, frac);
+    default:
+      return cubic(data, length, index, frac);
+    }
+  }
+};
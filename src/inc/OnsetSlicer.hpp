@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include "SampleBuffer.hpp"
+
+// OnsetSlicer finds transients in a sample and returns the frames they start
+// on, so a long file (a drum break, say) can be played back slice by slice.
+// the detection function is the rise in energy of the first difference of
+// the signal from one hop to the next, which favours the bright attack of a
+// hit over slow changes in level. peaks above a moving average of that
+// function become slice points
+
+#define SLICER_HOP 512
+#define SLICER_AVERAGE_HOPS 8
+#define SLICER_MAX_SLICES 256
+
+struct OnsetSlicer
+{
+  // threshold over the moving average a peak needs to count as an onset
+  float sensitivity = 1.5f;
+  // shortest slice allowed, in seconds
+  float min_gap = 0.05f;
+
+  std::vector<int64_t> slice(const SampleBuffer &buffer, int sample_rate) const
+  {
+    std::vector<int64_t> slices = {0};
+    int64_t hops = buffer.length / SLICER_HOP;
+    if (hops < 3 || buffer.channels == 0)
+    {
+      return slices;
+    }
+
+    // energy of the first difference of a mono mix, per hop
+    std::vector<float> energy(hops, 0.f);
+    for (int c = 0; c < buffer.channels; c++)
+    {
+      const float *data = buffer.channel(c);
+      for (int64_t h = 0; h < hops; h++)
+      {
+        const float *frame = data + h * SLICER_HOP;
+        float previous = h > 0 ? frame[-1] : frame[0];
+        float sum = 0.f;
+        for (int i = 0; i < SLICER_HOP; i++)
+        {
+          float diff = frame[i] - previous;
+          sum += diff * diff;
+          previous = frame[i];
+        }
+        energy[h] += sum;
+      }
+    }
+
+    // rise in log energy from hop to hop
+    std::vector<float> onset(hops, 0.f);
+    for (int64_t h = 1; h < hops; h++)
+    {
+      onset[h] = std::max(0.f, std::log(energy[h] + 1e-6f) - std::log(energy[h - 1] + 1e-6f));
+    }
+
+    int64_t gap_hops = std::max<int64_t>(1, (int64_t)(min_gap * sample_rate / SLICER_HOP));
+    int64_t last = 0;
+    for (int64_t h = 1; h < hops - 1 && (int)slices.size() < SLICER_MAX_SLICES; h++)
+    {
+      if (onset[h] <= onset[h - 1] || onset[h] < onset[h + 1] || h - last < gap_hops)
+      {
+        continue;
+      }
+      float average = 0.f;
+      int64_t from = std::max<int64_t>(0, h - SLICER_AVERAGE_HOPS);
+      int64_t to = std::min<int64_t>(hops - 1, h + SLICER_AVERAGE_HOPS);
+      for (int64_t k = from; k <= to; k++)
+      {
+        average += onset[k];
+      }
+      average /= (to - from + 1);
+      if (onset[h] > average * sensitivity + 0.5f)
+      {
+        int64_t frame = refine(buffer.channel(0), h * SLICER_HOP);
+        if (frame > slices.back())
+        {
+          slices.push_back(frame);
+          last = h;
+        }
+      }
+    }
+    return slices;
+  }
+
+  // moves a slice point from the start of its hop to where the hit actually
+  // begins, then back to the zero crossing before that so the slice doesn't
+  // start with a click
+  static int64_t refine(const float *data, int64_t hop_start)
+  {
+    float peak = 0.f;
+    for (int i = 0; i < SLICER_HOP; i++)
+    {
+      peak = std::max(peak, std::fabs(data[hop_start + i]));
+    }
+    int64_t frame = hop_start;
+    while (frame < hop_start + SLICER_HOP - 1 && std::fabs(data[frame]) < peak * 0.5f)
+    {
+      frame++;
+    }
+    for (int64_t i = frame; i > std::max<int64_t>(1, hop_start - SLICER_HOP / 4); i--)
+    {
+      if ((data[i - 1] <= 0.f) != (data[i] <= 0.f))
+      {
+        return i;
+      }
+    }
+    return frame;
+  }
+};
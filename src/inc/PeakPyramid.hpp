@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include "SampleBuffer.hpp"
+
+// PeakPyramid keeps min/max pairs of a sample at several zoom levels, so a
+// waveform can be drawn by looking at a couple of bins per pixel however long
+// the file is. level 0 has a bin per PEAK_BASE_FRAMES frames of all channels
+// together, every level above it merges pairs of bins from the one below
+
+#define PEAK_BASE_FRAMES 64
+
+struct PeakPyramid
+{
+  struct Peak
+  {
+    float min = 0.f;
+    float max = 0.f;
+  };
+
+  std::vector<std::vector<Peak>> levels;
+  int64_t length = 0;
+
+  void build(const SampleBuffer &buffer)
+  {
+    levels.clear();
+    length = buffer.length;
+    int64_t bins = (length + PEAK_BASE_FRAMES - 1) / PEAK_BASE_FRAMES;
+    if (bins == 0)
+    {
+      return;
+    }
+
+    std::vector<Peak> base(bins);
+    for (int64_t b = 0; b < bins; b++)
+    {
+      int64_t start = b * PEAK_BASE_FRAMES;
+      int64_t end = std::min<int64_t>(start + PEAK_BASE_FRAMES, length);
+      Peak peak = {buffer.channel(0)[start], buffer.channel(0)[start]};
+      for (int c = 0; c < buffer.channels; c++)
+      {
+        const float *data = buffer.channel(c);
+        for (int64_t i = start; i < end; i++)
+        {
+          peak.min = std::min(peak.min, data[i]);
+          peak.max = std::max(peak.max, data[i]);
+        }
+      }
+      base[b] = peak;
+    }
+    levels.push_back(std::move(base));
+
+    while (levels.back().size() > 1)
+    {
+      const std::vector<Peak> &below = levels.back();
+      std::vector<Peak> level((below.size() + 1) / 2);
+      for (size_t b = 0; b < level.size(); b++)
+      {
+        const Peak &a = below[b * 2];
+        const Peak &c = b * 2 + 1 < below.size() ? below[b * 2 + 1] : a;
+        level[b] = {std::min(a.min, c.min), std::max(a.max, c.max)};
+      }
+      levels.push_back(std::move(level));
+    }
+  }
+
+  // min and max of the frames from start to end, read from the coarsest
+  // level whose bins are still no wider than the range
+  Peak range(double start, double end) const
+  {
+    Peak peak;
+    if (levels.empty())
+    {
+      return peak;
+    }
+    double frames = std::max(1.0, end - start);
+    int level = 0;
+    while (level + 1 < (int)levels.size() && (double)((int64_t)PEAK_BASE_FRAMES << (level + 1)) <= frames)
+    {
+      level++;
+    }
+    const std::vector<Peak> &bins = levels[level];
+    int64_t bin_frames = (int64_t)PEAK_BASE_FRAMES << level;
+    int64_t first = clamp((int64_t)(start / bin_frames), 0, (int64_t)bins.size() - 1);
+    int64_t last = clamp((int64_t)((end - 1) / bin_frames), first, (int64_t)bins.size() - 1);
+    peak = bins[first];
+    for (int64_t b = first + 1; b <= last; b++)
+    {
+      peak.min = std::min(peak.min, bins[b].min);
+      peak.max = std::max(peak.max, bins[b].max);
+    }
+    return peak;
+  }
+
+  static int64_t clamp(int64_t x, int64_t lo, int64_t hi)
+  {
+    return std::max(lo, std::min(x, hi));
+  }
+};
@@ -1,4 +1,8 @@
-#include "rack.hpp"
+#pragma once
+
+#include "../plugin.hpp"
+
+#define QUANTIZER_BINS 24
 
 struct Quantizer
 {
@@ -45,10 +49,18 @@ struct Quantizer
     BLUES
   };
 
-  float quantize(float input, int root, int scale)
+  // quantize() looks notes up in a table holding the closest scale note for
+  // each half-semitone bin of an octave. the bin edges fall on the midpoints
+  // between notes, so the lookup matches scanning the scale, and the table
+  // only has to be rebuilt when the root or scale changes
+  float scale_table[QUANTIZER_BINS] = {0.f};
+  int table_root = -1;
+  int table_scale = -1;
+
+  void get_scale(int scale, const int *&curr_scale, int &curr_scale_size)
   {
-    const int *curr_scale = SCALE_CHROMATIC;
-    int curr_scale_size = 12;
+    curr_scale = SCALE_CHROMATIC;
+    curr_scale_size = 12;
     switch (scale)
     {
     case CHROMATIC:
@@ -96,53 +108,111 @@ struct Quantizer
       curr_scale_size = 6;
       break;
     }
+  }
 
-    float closest_value = 0.0f;
-    float closest_distance = 100.0f;
-    float note_in_volts = 0.0f;
-    float distance = 0.0f;
-    int octave = int(floorf(input));
-    float volts_minus_octave = input - octave;
-
-    for (int i = 0; i < curr_scale_size; i++)
+  void build_table(float *table, int root, const int *curr_scale, int length)
+  {
+    for (int bin = 0; bin < QUANTIZER_BINS; bin++)
     {
-      note_in_volts = (curr_scale[i] + root) % 12 / 12.0f;
-      distance = fabsf(volts_minus_octave - note_in_volts);
-      if (distance < closest_distance)
+      float closest_value = 0.0f;
+      float closest_distance = 100.0f;
+      float volts_minus_octave = (bin + 0.5f) / QUANTIZER_BINS;
+
+      for (int i = 0; i < length; i++)
       {
-        closest_distance = distance;
-        closest_value = note_in_volts;
+        float note_in_volts = (curr_scale[i] + root) % 12 / 12.0f;
+        float distance = fabsf(volts_minus_octave - note_in_volts);
+        if (distance < closest_distance)
+        {
+          closest_distance = distance;
+          closest_value = note_in_volts;
+        }
       }
+
+      table[bin] = closest_value;
     }
+  }
 
-    return closest_value + octave;
+  float lookup(const float *table, float input)
+  {
+    float octave = floorf(input);
+    int bin = (int)((input - octave) * QUANTIZER_BINS);
+    bin = clamp(bin, 0, QUANTIZER_BINS - 1);
+    return table[bin] + octave;
   }
 
-  float quantize(float input, int root, int scale[], int length)
+  void update_scale_table(int root, int scale)
   {
-    int curr_scale[length];
-    for (int i = 0; i < length; i++)
+    if (root != table_root || scale != table_scale)
     {
-      curr_scale[i] = scale[i];
+      const int *curr_scale;
+      int curr_scale_size;
+      get_scale(scale, curr_scale, curr_scale_size);
+      build_table(scale_table, root, curr_scale, curr_scale_size);
+      table_root = root;
+      table_scale = scale;
+    }
+  }
+
+  float quantize(float input, int root, int scale)
+  {
+    update_scale_table(root, scale);
+    return lookup(scale_table, input);
+  }
+
+  float custom_table[QUANTIZER_BINS] = {0.f};
+  int custom_table_root = -1;
+  int custom_table_len = -1;
+  int custom_table_scale[12] = {0};
+
+  void update_custom_table(int root, int scale[], int length)
+  {
+    length = clamp(length, 0, 12);
+    bool changed = root != custom_table_root || length != custom_table_len;
+    for (int i = 0; i < length && !changed; i++)
+    {
+      changed = scale[i] != custom_table_scale[i];
+    }
+    if (!changed)
+    {
+      return;
     }
-    float closest_value = 0.0f;
-    float closest_distance = 100.0f;
-    float note_in_volts = 0.0f;
-    float distance = 0.0f;
-    int octave = int(floorf(input));
-    float volts_minus_octave = input - octave;
 
     for (int i = 0; i < length; i++)
     {
-      note_in_volts = (curr_scale[i] + root) % 12 / 12.0f;
-      distance = fabsf(volts_minus_octave - note_in_volts);
-      if (distance < closest_distance)
-      {
-        closest_distance = distance;
-        closest_value = note_in_volts;
-      }
+      custom_table_scale[i] = scale[i];
     }
+    build_table(custom_table, root, custom_table_scale, length);
+    custom_table_root = root;
+    custom_table_len = length;
+  }
 
-    return closest_value + octave;
+  float quantize(float input, int root, int scale[], int length)
+  {
+    update_custom_table(root, scale, length);
+    return lookup(custom_table, input);
+  }
+
+  // four channel versions of the above, sharing the same tables. only the
+  // final table read is done per lane, since sse has no gather
+  simd::float_4 lookup(const float *table, simd::float_4 input)
+  {
+    simd::float_4 octave = simd::floor(input);
+    simd::float_4 position = clamp((input - octave) * QUANTIZER_BINS, 0.f, QUANTIZER_BINS - 1);
+    simd::int32_4 bin = simd::int32_4(position);
+    simd::float_4 notes(table[bin[0]], table[bin[1]], table[bin[2]], table[bin[3]]);
+    return notes + octave;
+  }
+
+  simd::float_4 quantizeSimd(simd::float_4 input, int root, int scale)
+  {
+    update_scale_table(root, scale);
+    return lookup(scale_table, input);
+  }
+
+  simd::float_4 quantizeSimd(simd::float_4 input, int root, int scale[], int length)
+  {
+    update_custom_table(root, scale, length);
+    return lookup(custom_table, input);
   }
-};
\ No newline at end of file
+};
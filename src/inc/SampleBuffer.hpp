@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+
+// SampleBuffer keeps every channel of a sample in one allocation. channels
+// are stored one after another (planar), each starting on a 64 byte
+// boundary. channel() is a single offset from the start of the buffer, so
+// the playback loops read through it directly instead of keeping their own
+// copies of the channel pointers
+
+#define SAMPLE_BUFFER_ALIGN 64
+
+struct SampleBuffer
+{
+  std::unique_ptr<float[]> storage;
+  float *data = nullptr;
+  size_t stride = 0;
+  int channels = 0;
+  int64_t length = 0;
+
+  // allocates zeroed room for the given number of frames per channel
+  void allocate(int num_channels, int64_t num_frames)
+  {
+    const size_t align = SAMPLE_BUFFER_ALIGN / sizeof(float);
+    stride = ((size_t)num_frames + align - 1) / align * align;
+    channels = num_channels;
+    length = num_frames;
+    storage.reset(new float[stride * channels + align]());
+    uintptr_t address = (uintptr_t)storage.get();
+    data = (float *)((address + SAMPLE_BUFFER_ALIGN - 1) / SAMPLE_BUFFER_ALIGN * SAMPLE_BUFFER_ALIGN);
+  }
+
+  // shrinks the number of frames in use, the allocation stays as it is
+  void truncate(int64_t num_frames)
+  {
+    length = std::min(length, num_frames);
+  }
+
+  float *channel(int c)
+  {
+    return data + stride * c;
+  }
+
+  const float *channel(int c) const
+  {
+    return data + stride * c;
+  }
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <rack.hpp>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include "PeakPyramid.hpp"
+#include "SampleBuffer.hpp"
+
+// SampleCache shares decoded samples between module instances. samples are
+// keyed by path, modification time, the sample rate they were converted to
+// and the quality of that conversion (if there was one), and handed out as read-only shared
+// pointers, so two modules that load the same file at the same rate share a
+// single copy. the cache only holds weak references, a sample is freed once
+// the last module lets go of it
+
+using namespace rack;
+
+struct SampleData
+{
+  SampleBuffer buffer;
+  int sample_rate = 0;
+  // first frame of each slice, always starts with 0
+  std::vector<int64_t> slices;
+  PeakPyramid peaks;
+};
+
+typedef std::shared_ptr<const SampleData> SampleRef;
+
+struct SampleCache
+{
+  struct Entry
+  {
+    std::mutex mutex;
+    std::weak_ptr<const SampleData> data;
+    int pending = 0;
+  };
+
+  std::mutex mutex;
+  std::map<std::string, std::shared_ptr<Entry>> entries;
+
+  // quality only matters to samples that were converted, native rate loads
+  // all share one key whatever it is set to
+  static std::string key(const std::string &path, int sample_rate, int quality)
+  {
+    if (sample_rate == 0)
+    {
+      quality = 0;
+    }
+    return path + "|" + std::to_string(system::getModifiedTime(path)) + "|" + std::to_string(sample_rate) + "|" + std::to_string(quality);
+  }
+
+  // returns the cached sample, or calls load to make it. concurrent requests
+  // for the same key wait for the first one instead of decoding again
+  SampleRef get(const std::string &path, int sample_rate, int quality, std::function<bool(SampleData &)> load)
+  {
+    std::shared_ptr<Entry> entry;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      prune();
+      std::shared_ptr<Entry> &slot = entries[key(path, sample_rate, quality)];
+      if (!slot)
+      {
+        slot = std::make_shared<Entry>();
+      }
+      entry = slot;
+      entry->pending++;
+    }
+
+    SampleRef result;
+    {
+      std::lock_guard<std::mutex> lock(entry->mutex);
+      result = entry->data.lock();
+      if (!result)
+      {
+        std::shared_ptr<SampleData> data = std::make_shared<SampleData>();
+        if (load(*data))
+        {
+          result = data;
+          entry->data = result;
+        }
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    entry->pending--;
+    return result;
+  }
+
+  // drops entries nobody is using or waiting on
+  void prune()
+  {
+    for (auto it = entries.begin(); it != entries.end();)
+    {
+      if (it->second->pending == 0 && it->second->data.expired())
+      {
+        it = entries.erase(it);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+  }
+};
+
+inline SampleCache &sample_cache()
+{
+  static SampleCache cache;
+  return cache;
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <rack.hpp>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include "AudioFile.h"
+
+// SampleStream plays a wav or aiff file straight from disk. the first
+// STREAM_PREROLL_FRAMES frames are decoded up front so a voice can start the
+// moment it is triggered, and a background thread keeps a lock-free ring
+// buffer per voice topped up with the frames that follow. only the first two
+// channels of the file are streamed. the rings take 2 MB, so they only
+// exist while a file is open
+
+#define STREAM_PREROLL_FRAMES 65536
+#define STREAM_RING_FRAMES 16384
+#define STREAM_CHUNK_FRAMES 2048
+#define STREAM_MAX_VOICES 16
+
+using namespace rack;
+
+struct SampleStream
+{
+  struct Voice
+  {
+    dsp::RingBuffer<dsp::Frame<2>, STREAM_RING_FRAMES> ring;
+    // the audio thread bumps generation on every trigger. the disk thread
+    // answers by emptying the ring and refilling it from the end of the
+    // preroll, then publishes ring_generation. the audio thread only reads
+    // the ring while the two match, which is what makes the clear() safe
+    std::atomic<uint32_t> generation{0};
+    std::atomic<uint32_t> ring_generation{0};
+    std::atomic<bool> active{false};
+    int64_t disk_position = 0;
+
+    int64_t position = 0;
+    float frac = 0.f;
+    dsp::Frame<2> a = {};
+    dsp::Frame<2> b = {};
+  };
+
+  AudioFileReader<float> reader;
+  std::vector<float> interleaved;
+  std::vector<dsp::Frame<2>> preroll;
+  int64_t preroll_frames = 0;
+  int64_t num_frames = 0;
+  int num_channels = 0;
+  int sample_rate = 0;
+  std::unique_ptr<Voice[]> voices;
+  std::unique_ptr<std::thread> disk_thread;
+  std::atomic<bool> running{false};
+
+  ~SampleStream()
+  {
+    close();
+  }
+
+  // not safe to call while the audio thread is reading voices
+  bool open(const std::string &path)
+  {
+    close();
+    if (!reader.open(path))
+    {
+      return false;
+    }
+    num_frames = reader.getNumFrames();
+    num_channels = reader.getNumChannels();
+    sample_rate = reader.getSampleRate();
+    preroll_frames = std::min<int64_t>(num_frames, STREAM_PREROLL_FRAMES);
+    preroll.resize(preroll_frames);
+    preroll_frames = read(preroll.data(), 0, (int)preroll_frames);
+
+    voices.reset(new Voice[STREAM_MAX_VOICES]);
+
+    running = true;
+    disk_thread = std::make_unique<std::thread>([this]()
+                                                { this->disk_loop(); });
+    return true;
+  }
+
+  void close()
+  {
+    running = false;
+    if (disk_thread)
+    {
+      disk_thread->join();
+      disk_thread.reset();
+    }
+    reader.close();
+    voices.reset();
+    num_frames = 0;
+    preroll_frames = 0;
+  }
+
+  // reads up to `frames` frames starting at frame `start` as left/right
+  // pairs, mono files go to both sides. returns the number of frames read
+  int read(dsp::Frame<2> *dst, int64_t start, int frames)
+  {
+    if (!reader.seek(start))
+    {
+      return 0;
+    }
+    interleaved.resize((size_t)frames * num_channels);
+    frames = reader.readFrames(interleaved.data(), frames);
+    int right = num_channels > 1 ? 1 : 0;
+    for (int i = 0; i < frames; i++)
+    {
+      const float *frame = interleaved.data() + (size_t)i * num_channels;
+      dst[i].samples[0] = frame[0];
+      dst[i].samples[1] = frame[right];
+    }
+    return frames;
+  }
+
+  void disk_loop()
+  {
+    dsp::Frame<2> chunk[STREAM_CHUNK_FRAMES];
+    while (running)
+    {
+      bool idle = true;
+      for (int i = 0; i < STREAM_MAX_VOICES; i++)
+      {
+        Voice &voice = voices[i];
+        uint32_t generation = voice.generation.load(std::memory_order_acquire);
+        if (generation != voice.ring_generation.load(std::memory_order_relaxed))
+        {
+          voice.ring.clear();
+          voice.disk_position = preroll_frames;
+          voice.ring_generation.store(generation, std::memory_order_release);
+        }
+        if (!voice.active || voice.disk_position >= num_frames)
+        {
+          continue;
+        }
+        if (voice.ring.capacity() < STREAM_CHUNK_FRAMES)
+        {
+          continue;
+        }
+        int frames = read(chunk, voice.disk_position, STREAM_CHUNK_FRAMES);
+        voice.ring.pushBuffer(chunk, frames);
+        voice.disk_position += frames;
+        idle = false;
+      }
+      if (idle)
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+      }
+    }
+  }
+
+  // the fetch_frame/start/stop/next functions run on the audio thread
+
+  // frames have to be fetched in order, since past the preroll they come
+  // off the voice's ring
+  bool fetch_frame(Voice &voice, int64_t index, dsp::Frame<2> &frame)
+  {
+    if (index < preroll_frames)
+    {
+      frame = preroll[index];
+      return true;
+    }
+    if (index >= num_frames)
+    {
+      frame = {};
+      return true;
+    }
+    if (voice.ring_generation.load(std::memory_order_acquire) != voice.generation.load(std::memory_order_relaxed) || voice.ring.empty())
+    {
+      return false;
+    }
+    frame = voice.ring.shift();
+    return true;
+  }
+
+  void start(int v)
+  {
+    Voice &voice = voices[v];
+    voice.generation.fetch_add(1, std::memory_order_release);
+    voice.active = true;
+    voice.position = 0;
+    voice.frac = 0.f;
+    fetch_frame(voice, 0, voice.a);
+    fetch_frame(voice, 1, voice.b);
+  }
+
+  void stop(int v)
+  {
+    voices[v].active = false;
+  }
+
+  // advances a voice by `ratio` file frames, linearly interpolating between
+  // them. returns false once the voice has played past the end of the file.
+  // if the disk thread falls behind the voice holds its position
+  bool next(int v, float ratio, float &left, float &right)
+  {
+    Voice &voice = voices[v];
+    if (voice.position >= num_frames)
+    {
+      left = right = 0.f;
+      return false;
+    }
+    left = voice.a.samples[0] + (voice.b.samples[0] - voice.a.samples[0]) * voice.frac;
+    right = voice.a.samples[1] + (voice.b.samples[1] - voice.a.samples[1]) * voice.frac;
+
+    voice.frac += ratio;
+    while (voice.frac >= 1.f)
+    {
+      dsp::Frame<2> frame;
+      if (!fetch_frame(voice, voice.position + 2, frame))
+      {
+        voice.frac = 1.f;
+        break;
+      }
+      voice.a = voice.b;
+      voice.b = frame;
+      voice.position++;
+      voice.frac -= 1.f;
+    }
+    return true;
+  }
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <rack.hpp>
+#include <cmath>
+
+// WaveMipmap keeps octave spaced, band-limited copies of a single cycle
+// waveform. the table is first stretched to MIPMAP_SIZE points as a
+// staircase, which is what reading it without interpolation sounds like,
+// then every level above the first keeps half the harmonics of the one
+// below it. an oscillator reads the two levels around its pitch and fades
+// between them, so nothing above nyquist gets through at any frequency
+//
+// it can hold a separate waveform for each voice. all of them live in one
+// slab laid out as [voice][level][point], so a block of four voices reads
+// from neighbouring rows
+
+#define MIPMAP_SIZE 2048
+#define MIPMAP_LEVELS 11
+// one guard point past the end of each level so reads can interpolate
+// without wrapping
+#define MIPMAP_STRIDE (MIPMAP_SIZE + 1)
+
+using namespace rack;
+
+struct WaveMipmap
+{
+  std::vector<float> levels;
+  int voices = 0;
+
+  dsp::RealFFT fft{MIPMAP_SIZE};
+  alignas(16) float time[MIPMAP_SIZE];
+  alignas(16) float spectrum[MIPMAP_SIZE];
+  alignas(16) float filtered[MIPMAP_SIZE];
+
+  WaveMipmap()
+  {
+    resize(1);
+  }
+
+  // allocates, so keep it off the audio thread
+  void resize(int voices)
+  {
+    this->voices = voices;
+    levels.assign((size_t)voices * MIPMAP_LEVELS * MIPMAP_STRIDE, 0.f);
+  }
+
+  float *level_data(int voice, int level)
+  {
+    return levels.data() + ((size_t)voice * MIPMAP_LEVELS + level) * MIPMAP_STRIDE;
+  }
+
+  const float *level_data(int voice, int level) const
+  {
+    return levels.data() + ((size_t)voice * MIPMAP_LEVELS + level) * MIPMAP_STRIDE;
+  }
+
+  void build(int voice, const float *table, int size)
+  {
+    for (int i = 0; i < MIPMAP_SIZE; i++)
+    {
+      time[i] = table[(int64_t)i * size / MIPMAP_SIZE];
+    }
+    float *data = level_data(voice, 0);
+    std::copy(time, time + MIPMAP_SIZE, data);
+    data[MIPMAP_SIZE] = data[0];
+
+    // the ordered spectrum is dc, nyquist, then re/im pairs for each bin
+    fft.rfft(time, spectrum);
+    for (int level = 1; level < MIPMAP_LEVELS; level++)
+    {
+      int harmonics = (MIPMAP_SIZE / 2) >> level;
+      std::copy(spectrum, spectrum + MIPMAP_SIZE, filtered);
+      filtered[1] = 0.f;
+      for (int bin = harmonics + 1; bin < MIPMAP_SIZE / 2; bin++)
+      {
+        filtered[2 * bin] = 0.f;
+        filtered[2 * bin + 1] = 0.f;
+      }
+      fft.irfft(filtered, time);
+      data = level_data(voice, level);
+      for (int i = 0; i < MIPMAP_SIZE; i++)
+      {
+        data[i] = time[i] / MIPMAP_SIZE;
+      }
+      data[MIPMAP_SIZE] = data[0];
+    }
+  }
+
+  // reads the four voices starting at first. phase is from 0 to 1, level is
+  // log2 of the frequency in cycles per sample times MIPMAP_SIZE. the fade
+  // runs between the first level that is clean at this pitch and the next
+  // one up, so it keeps out of the aliasing and has no jump as the pitch
+  // crosses an octave. only the table lookups are done a lane at a time, and
+  // with a single waveform every voice reads it
+  simd::float_4 read4(int first, simd::float_4 phase, simd::float_4 level) const
+  {
+    level = simd::fmax(level, -1.f);
+    simd::float_4 floor_level = simd::floor(level);
+    simd::float_4 low = simd::fmin(floor_level + 1.f, (float)(MIPMAP_LEVELS - 1));
+    simd::float_4 high = simd::fmin(low + 1.f, (float)(MIPMAP_LEVELS - 1));
+    simd::float_4 fade = level - floor_level;
+    simd::float_4 position = phase * MIPMAP_SIZE;
+    simd::float_4 index = simd::fmin(simd::floor(position), (float)(MIPMAP_SIZE - 1));
+    simd::float_4 frac = position - index;
+
+    simd::float_4 low0, low1, high0, high1;
+    for (int i = 0; i < 4; i++)
+    {
+      int voice = (voices > 1) ? std::min(first + i, voices - 1) : 0;
+      const float *l = level_data(voice, (int)low[i]) + (int)index[i];
+      const float *h = level_data(voice, (int)high[i]) + (int)index[i];
+      low0[i] = l[0];
+      low1[i] = l[1];
+      high0[i] = h[0];
+      high1[i] = h[1];
+    }
+    simd::float_4 a = low0 + (low1 - low0) * frac;
+    simd::float_4 b = high0 + (high1 - high0) * frac;
+    return a + (b - a) * fade;
+  }
+};
@@ -1,11 +1,19 @@
 #include "plugin.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include "inc/SimplexNoise.hpp"
+#include "inc/WaveMipmap.hpp"
 #include "widgets/PanelBackground.hpp"
 #include "widgets/InverterWidget.hpp"
 
 #define MIN_TABLE_SIZE 64
 #define MAX_TABLE_SIZE 1024
 #define DEFAULT_TABLE_SIZE 64
+#define MAX_MORPH_CYCLES 16.f
+// set on the ready slot index while the audio thread hasn't picked it up
+#define TABLE_FRESH 4
 
 using simd::float_4;
 
@@ -21,12 +29,48 @@ struct NoiseOSC
   std::vector<std::string> modeNames = {"rand", "simplex", "worley"};
   SimplexNoise simplexNoise;
   float xInc = 0.01f;
-  std::vector<float> phase;
-  std::vector<float> freq;
+  // four voices per float_4
+  float_4 phase[MAX_POLY / 4] = {};
+  float_4 freq[MAX_POLY / 4] = {};
+  // how far each voice is through the morph from the previous table,
+  // 1 once it only reads the current one
+  float_4 fade[MAX_POLY / 4];
+  int channels = 0;
+  // cycles each voice takes to morph into a new table, 0 swaps at once
+  float morphCycles = 1.f;
 
   float sampleRate = 44100.f;
+  float sampleTime = 1.f / 44100.f;
+  // the table is generated on the worker thread, and only touched
+  // elsewhere with tableMutex held. with per voice tables it holds a row of
+  // tableSize points for each voice, one after another
   int tableSize = DEFAULT_TABLE_SIZE;
+  int tableVoices = 1;
   std::vector<float> table;
+  std::mutex tableMutex;
+
+  // band-limited copies of the table are passed between the threads
+  // without locks. the audio thread reads mipmaps[front], and
+  // mipmaps[previous] while morphing away from it. the worker builds into
+  // mipmaps[back] and swaps it with ready, so neither ever waits on the other
+  WaveMipmap mipmaps[4];
+  int front = 0;
+  int previous = 3;
+  int back = 1;
+  std::atomic<int> ready{2};
+
+  // inject() only records what to make, the worker picks it up
+  std::atomic<uint32_t> injectRequests{0};
+  std::atomic<int> injectMode{RAND};
+  std::atomic<int> injectSize{DEFAULT_TABLE_SIZE};
+  std::atomic<int> injectVoices{1};
+  // set when a table restored from the patch needs publishing
+  std::atomic<bool> tableLoaded{false};
+  std::atomic<bool> running{true};
+  // the worker sleeps on this until wake() says there's something to do
+  std::mutex wakeMutex;
+  std::condition_variable wakeCondition;
+  std::thread worker;
 
   struct WPoint
   {
@@ -36,92 +80,177 @@ struct NoiseOSC
 
   NoiseOSC()
   {
-    rand_regen();
+    regen(RAND, tableSize, 1);
     simplexNoise.init();
+    for (int i = 0; i < MAX_POLY / 4; i++)
+    {
+      fade[i] = 1.f;
+    }
+    mipmaps[front].build(0, table.data(), tableSize);
+    worker = std::thread([this]()
+                         { this->work(); });
+  }
+
+  ~NoiseOSC()
+  {
+    running = false;
+    wake();
+    worker.join();
+  }
+
+  // called after changing injectRequests, tableLoaded or running. the
+  // mutex is only held by the worker while it checks those, so this never
+  // waits on a table being made
+  void wake()
+  {
+    {
+      std::lock_guard<std::mutex> lock(wakeMutex);
+    }
+    wakeCondition.notify_one();
+  }
+
+  void work()
+  {
+    // rack's random state is per thread
+    random::init();
+    uint32_t handled = 0;
+    while (true)
+    {
+      {
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        wakeCondition.wait(lock, [&]()
+                           { return !running || injectRequests.load() != handled || tableLoaded.load(); });
+      }
+      if (!running)
+      {
+        return;
+      }
+      uint32_t requests = injectRequests.load();
+      tableLoaded = false;
+      std::lock_guard<std::mutex> lock(tableMutex);
+      if (requests != handled)
+      {
+        handled = requests;
+        regen(injectMode, injectSize, injectVoices);
+      }
+      table.resize(tableVoices * tableSize, 0.f);
+      if (mipmaps[back].voices != tableVoices)
+      {
+        mipmaps[back].resize(tableVoices);
+      }
+      for (int v = 0; v < tableVoices; v++)
+      {
+        mipmaps[back].build(v, table.data() + v * tableSize, tableSize);
+      }
+      back = ready.exchange(back | TABLE_FRESH) & ~TABLE_FRESH;
+    }
+  }
+
+  // called by the audio thread before reading, picks up the newest table
+  // once every voice has finished morphing into the current one. tables
+  // injected in the meantime are coalesced by the worker
+  void acquireTable()
+  {
+    if (!(ready.load(std::memory_order_relaxed) & TABLE_FRESH))
+    {
+      return;
+    }
+    for (int c = 0; c < channels; c += 4)
+    {
+      if (simd::movemask(fade[c / 4] < 1.f))
+      {
+        return;
+      }
+    }
+    int fresh = ready.exchange(previous) & ~TABLE_FRESH;
+    previous = front;
+    front = fresh;
+    for (int c = 0; c < MAX_POLY; c += 4)
+    {
+      fade[c / 4] = (c < channels && morphCycles > 0.f) ? 0.f : 1.f;
+    }
   }
 
-  float get_min()
+  // the helpers below work on one voice's row of the table
+  float get_min(const float *t)
   {
     float min = 10.f;
     for (int i = 0; i < tableSize; i++)
     {
-      if (table[i] < min)
+      if (t[i] < min)
       {
-        min = table[i];
+        min = t[i];
       }
     }
     return min;
   }
 
-  float get_max()
+  float get_max(const float *t)
   {
     float max = -10.f;
     for (int i = 0; i < tableSize; i++)
     {
-      if (table[i] > max)
+      if (t[i] > max)
       {
-        max = table[i];
+        max = t[i];
       }
     }
     return max;
   }
 
-  float get_avg()
+  float get_avg(const float *t)
   {
     float avg = 0.f;
     for (int i = 0; i < tableSize; i++)
     {
-      avg += table[i];
+      avg += t[i];
     }
     return avg / tableSize;
   }
 
-  void apply_offset()
+  void apply_offset(float *t)
   {
-    float avg = get_avg();
+    float avg = get_avg(t);
     for (int i = 0; i < tableSize; i++)
     {
-      table[i] -= avg;
+      t[i] -= avg;
     }
   }
 
-  void rescale()
+  void rescale(float *t)
   {
-    float min = get_min();
-    float max = get_max();
+    float min = get_min(t);
+    float max = get_max(t);
     float range = max - min;
     for (int i = 0; i < tableSize; i++)
     {
-      table[i] = (table[i] - min) / range * 2.f - 1.f;
+      t[i] = (t[i] - min) / range * 2.f - 1.f;
     }
-    apply_offset();
+    apply_offset(t);
   }
 
-  void rand_regen()
+  void rand_regen(float *t)
   {
-    table.clear();
     for (int i = 0; i < tableSize; i++)
     {
-      table.push_back(random::uniform() * 2.f - 1.f);
+      t[i] = random::uniform() * 2.f - 1.f;
     }
-    rescale();
+    rescale(t);
   }
 
-  void simplex_regen()
+  void simplex_regen(float *t)
   {
-    table.clear();
     float x = random::u32() % 10000;
     for (int i = 0; i < tableSize; i++)
     {
       x += xInc;
-      table.push_back(simplexNoise.noise(x, 0));
+      t[i] = simplexNoise.noise(x, 0);
     }
-    rescale();
+    rescale(t);
   }
 
-  void worley_regen()
+  void worley_regen(float *t)
   {
-    table.clear();
     std::vector<WPoint> points;
     for (int i = 0; i < (int)(tableSize * (xInc * 5.f)); i++)
     {
@@ -133,81 +262,104 @@ struct NoiseOSC
     for (int i = 0; i < tableSize; i++)
     {
       float minDist = 10.f;
+      // compare squared distances, only the nearest needs a sqrt
+      float x = (float)i / tableSize;
       for (int j = 0; j < (int)points.size(); j++)
       {
-        float dist = std::sqrt(std::pow(points[j].x - (float)i / tableSize, 2) + std::pow(points[j].y - 0.5f, 2));
+        float dx = points[j].x - x;
+        float dy = points[j].y - 0.5f;
+        float dist = dx * dx + dy * dy;
         if (dist < minDist)
         {
           minDist = dist;
         }
       }
-      table.push_back(minDist);
+      t[i] = std::sqrt(minDist);
     }
-    rescale();
+    rescale(t);
+  }
+
+  // safe to call from any thread, the table is made on the worker. voices
+  // is 1 for a table shared by every channel, or MAX_POLY for one each
+  void inject(int mode, int tableSize, int voices)
+  {
+    injectMode = mode;
+    injectSize = tableSize;
+    injectVoices = voices;
+    injectRequests++;
+    wake();
   }
 
-  void inject(int mode, int tableSize)
+  // fills every voice's row in one pass, so they are published together
+  void regen(int mode, int tableSize, int voices)
   {
     this->tableSize = tableSize;
-    switch (mode)
-    {
-    case RAND:
-    {
-      rand_regen();
-      break;
-    }
-    case SIMPLEX:
+    tableVoices = voices;
+    table.resize(voices * tableSize);
+    for (int v = 0; v < voices; v++)
     {
-      simplex_regen();
-      break;
-    }
-    case WORLEY:
-    {
-      worley_regen();
-      break;
-    }
+      float *t = table.data() + v * tableSize;
+      switch (mode)
+      {
+      case RAND:
+      {
+        rand_regen(t);
+        break;
+      }
+      case SIMPLEX:
+      {
+        simplex_regen(t);
+        break;
+      }
+      case WORLEY:
+      {
+        worley_regen(t);
+        break;
+      }
+      }
     }
   }
 
   void setFreqSimd(int chan, float_4 freq4)
   {
-    for (int i = 0; i < 4; i++)
-    {
-      if (chan + i < (int)freq.size())
-        freq[chan + i] = freq4[i];
-    }
+    freq[chan / 4] = freq4;
   }
 
   void setSampleRate(float sampleRate)
   {
     this->sampleRate = sampleRate;
+    sampleTime = 1.f / sampleRate;
   }
 
   void setChannels(int channels)
   {
-    phase.resize(channels, 0.f);
-    freq.resize(channels, dsp::FREQ_C4);
+    // voices that come back start from the top of the table, like they
+    // did when the phase was kept per channel
+    for (int c = channels; c < this->channels; c++)
+    {
+      phase[c / 4][c % 4] = 0.f;
+      fade[c / 4][c % 4] = 1.f;
+    }
+    this->channels = channels;
   }
 
   float_4 next4(int chan)
   {
-    float_4 out = 0.f;
-    for (int i = 0; i < 4; i++)
-    {
-      int c = chan + i;
-      if (c < (int)phase.size())
-      {
-        phase[c] += freq[c] / sampleRate;
-        if (phase[c] >= 1.f)
-          phase[c] -= 1.f;
-        int idx = (int)(phase[c] * tableSize) % tableSize;
-        out[i] = table[idx];
-      }
-      else
-      {
-        out[i] = 0.f;
-      }
+    float_4 &p = phase[chan / 4];
+    float_4 inc = freq[chan / 4] * sampleTime;
+    p += inc;
+    p -= simd::floor(p);
+    float_4 level = simd::log2(simd::fmax(inc, 1e-6f) * MIPMAP_SIZE);
+    float_4 out = mipmaps[front].read4(chan, p, level);
+    float_4 &f = fade[chan / 4];
+    if (!simd::movemask(f < 1.f))
+    {
+      return out;
     }
+    // only voices still morphing pay for the second read
+    float_4 old = mipmaps[previous].read4(chan, p, level);
+    out = old + (out - old) * f;
+    f = simd::fmin(f + inc / simd::fmax(morphCycles, 1e-6f), 1.f);
     return out;
   }
 };
@@ -242,6 +394,8 @@ struct Nos : Module
   dsp::BooleanTrigger injectButton;
   int tableSize = DEFAULT_TABLE_SIZE;
   int mode = NoiseOSC::RAND;
+  // give every channel its own table instead of sharing one
+  bool perVoice = false;
 
   Nos()
   {
@@ -266,42 +420,50 @@ struct Nos : Module
   void onReset() override
   {
     mode = NoiseOSC::RAND;
-    osc.inject((int)mode, tableSize);
+    perVoice = false;
+    osc.inject((int)mode, tableSize, 1);
   }
 
   void onRandomize() override
   {
-    osc.inject((int)mode, tableSize);
+    osc.inject((int)mode, tableSize, perVoice ? MAX_POLY : 1);
   }
 
   json_t *dataToJson() override
   {
     json_t *rootJ = json_object();
+    std::lock_guard<std::mutex> lock(osc.tableMutex);
     json_object_set_new(rootJ, "tableSize", json_integer(osc.tableSize));
+    json_object_set_new(rootJ, "tableVoices", json_integer(osc.tableVoices));
     json_t *tableJ = json_array();
-    for (int i = 0; i < osc.tableSize; i++)
+    for (int i = 0; i < osc.tableVoices * osc.tableSize; i++)
     {
       json_array_append_new(tableJ, json_real(osc.table[i]));
     }
     json_object_set_new(rootJ, "table", tableJ);
     json_object_set_new(rootJ, "mode", json_integer(mode));
     json_object_set_new(rootJ, "simplexSpeed", json_real(osc.xInc));
+    json_object_set_new(rootJ, "morphCycles", json_real(osc.morphCycles));
     return rootJ;
   }
 
   void dataFromJson(json_t *rootJ) override
   {
+    std::unique_lock<std::mutex> lock(osc.tableMutex);
     json_t *tableSizeJ = json_object_get(rootJ, "tableSize");
     if (tableSizeJ)
     {
       osc.tableSize = json_integer_value(tableSizeJ);
       osc.tableSize = clamp(osc.tableSize, MIN_TABLE_SIZE, MAX_TABLE_SIZE);
     }
+    json_t *tableVoicesJ = json_object_get(rootJ, "tableVoices");
+    osc.tableVoices = (tableVoicesJ && json_integer_value(tableVoicesJ) > 1) ? MAX_POLY : 1;
+    perVoice = osc.tableVoices > 1;
     json_t *tableJ = json_object_get(rootJ, "table");
     if (tableJ)
     {
       osc.table.clear();
-      for (int i = 0; i < osc.tableSize; i++)
+      for (int i = 0; i < osc.tableVoices * osc.tableSize; i++)
       {
         json_t *tableValueJ = json_array_get(tableJ, i);
         if (tableValueJ)
@@ -310,6 +472,10 @@ struct Nos : Module
         }
       }
     }
+    osc.table.resize(osc.tableVoices * osc.tableSize, 0.f);
+    osc.tableLoaded = true;
+    lock.unlock();
+    osc.wake();
     json_t *modeJ = json_object_get(rootJ, "mode");
     if (modeJ)
     {
@@ -320,6 +486,11 @@ struct Nos : Module
     {
       osc.xInc = clamp(json_real_value(simplexSpeedJ), 0.01f, 0.1f);
     }
+    json_t *morphCyclesJ = json_object_get(rootJ, "morphCycles");
+    if (morphCyclesJ)
+    {
+      osc.morphCycles = clamp(json_real_value(morphCyclesJ), 0.f, MAX_MORPH_CYCLES);
+    }
   }
 
   void process(const ProcessArgs &args) override
@@ -332,6 +503,7 @@ struct Nos : Module
     outputs[SIGNAL_OUTPUT].setChannels(channels);
 
     osc.setChannels(channels);
+    osc.acquireTable();
 
     float freq = params[FREQ_PARAM].getValue();
 
@@ -348,11 +520,11 @@ struct Nos : Module
 
     if (injectTrigger.process(inputs[INJECT_INPUT].getVoltage()))
     {
-      osc.inject((int)mode, tableSize);
+      osc.inject((int)mode, tableSize, perVoice ? MAX_POLY : 1);
     }
     if (injectButton.process(params[INJECT_PARAM].getValue()))
     {
-      osc.inject((int)mode, tableSize);
+      osc.inject((int)mode, tableSize, perVoice ? MAX_POLY : 1);
     }
     lights[INJECT_LIGHT].setBrightness((injectTrigger.isHigh() || injectButton.state) ? 1.f : 0.f);
   }
@@ -491,6 +663,68 @@ struct NosWidget : ModuleWidget
       }
     };
 
+    struct MorphQuantity : Quantity
+    {
+      float *cycles;
+
+      MorphQuantity(float *cycles)
+      {
+        this->cycles = cycles;
+      }
+
+      void setValue(float value) override
+      {
+        *cycles = clamp(value, 0.f, MAX_MORPH_CYCLES);
+      }
+
+      float getValue() override
+      {
+        return *cycles;
+      }
+
+      float getDefaultValue() override
+      {
+        return 1.f;
+      }
+
+      std::string getLabel() override
+      {
+        return "morph";
+      }
+
+      int getDisplayPrecision() override
+      {
+        return 2;
+      }
+
+      float getMinValue() override
+      {
+        return 0.f;
+      }
+
+      float getMaxValue() override
+      {
+        return MAX_MORPH_CYCLES;
+      }
+
+      std::string getUnit() override
+      {
+        return " cycles";
+      }
+    };
+
+    struct MorphSlider : ui::Slider
+    {
+      MorphSlider(float *cycles)
+      {
+        quantity = new MorphQuantity(cycles);
+      }
+      ~MorphSlider()
+      {
+        delete quantity;
+      }
+    };
+
     struct SizeQuantity : Quantity
     {
       Nos *module;
@@ -626,9 +860,22 @@ struct NosWidget : ModuleWidget
       menu->addChild(new ModeMenuItem(module, i));
     }
 
+    menu->addChild(createBoolMenuItem("per voice tables", "",
+                                      [=]()
+                                      { return module->perVoice; },
+                                      [=](bool perVoice)
+                                      {
+                                        module->perVoice = perVoice;
+                                        module->osc.inject(module->mode, module->tableSize, perVoice ? MAX_POLY : 1);
+                                      }));
+
     SpeedSlider *speedSlider = new SpeedSlider(&(module->osc.xInc));
     speedSlider->box.size.x = 200.f;
     menu->addChild(speedSlider);
+
+    MorphSlider *morphSlider = new MorphSlider(&(module->osc.morphCycles));
+    morphSlider->box.size.x = 200.f;
+    menu->addChild(morphSlider);
   }
 };
 
@@ -4,12 +4,38 @@
 #include <osdialog.h>
 #include <samplerate.h>
 #include "inc/AudioFile.h"
+#include "inc/CrossfadeTable.hpp"
+#include "inc/FlacDecoder.hpp"
+#include "inc/Interpolator.hpp"
+#include "inc/OnsetSlicer.hpp"
+#include "inc/SampleCache.hpp"
+#include "inc/SampleStream.hpp"
 #include "inc/cvRange.hpp"
 #include "widgets/PanelBackground.hpp"
 #include "widgets/InverterWidget.hpp"
+#include "widgets/Waveform.hpp"
+
+// shortest loop a voice will play, so loop points dragged together don't
+// turn into a buzz
+#define LOOP_MIN_FRAMES 64
+#define LOOP_MAX_CROSSFADE 0.5f
 
 struct Polyplay : Module
 {
+  enum ResampleQuality
+  {
+    RESAMPLE_FASTEST,
+    RESAMPLE_MEDIUM,
+    RESAMPLE_BEST,
+    RESAMPLE_QUALITIES_LEN
+  };
+  enum LoopMode
+  {
+    LOOP_OFF,
+    LOOP_FORWARD,
+    LOOP_PINGPONG,
+    LOOP_MODES_LEN
+  };
   enum ParamId
   {
     POLY_PARAM,
@@ -19,6 +45,8 @@ struct Polyplay : Module
   enum InputId
   {
     TRIGGER_INPUT,
+    VOCT_INPUT,
+    SLICE_INPUT,
     INPUTS_LEN
   };
   enum OutputId
@@ -35,25 +63,64 @@ struct Polyplay : Module
 
   dsp::SchmittTrigger button_trigger;
   dsp::SchmittTrigger input_trigger;
-  AudioFile<float> my_file;
+  // the loader publishes each new sample here and process() starts new
+  // voices on it, voices already playing keep the sample they started with
+  std::atomic<const SampleData *> published_sample{nullptr};
+  // samples the audio thread may still be reading, checked before a sample
+  // in held_samples is released
+  std::atomic<const SampleData *> active_sample{nullptr};
+  std::atomic<const SampleData *> voice_sample[MAX_POLY] = {};
+  std::vector<SampleRef> held_samples;
+  std::mutex held_samples_mutex;
+  // the sample the waveform display is showing, only used on the ui thread
+  SampleRef waveform_sample;
+  WaveformData waveform_data;
   int file_sample_rate;
   int rack_sample_rate = APP->engine->getSampleRate();
-  int num_samples;
+  int64_t num_samples;
   int num_channels;
-  int current_wav_sample[MAX_POLY];
+  double position[MAX_POLY] = {0.0};
+  // frames a voice starts and stops at, the whole file or a single slice
+  int64_t voice_start[MAX_POLY] = {0};
+  int64_t voice_end[MAX_POLY] = {0};
   int current_poly_channel = 0;
   bool playing[MAX_POLY] = {false};
   bool load_success = false;
   bool file_loaded = false;
   std::string loaded_file_name;
   std::string file_path;
-  SRC_STATE *src;
   std::unique_ptr<std::thread> load_thread;
   std::mutex lock_thread_mutex;
   std::atomic<bool> process_audio{true};
+  // set while either kind of load runs, process_audio only drops for streams
+  std::atomic<bool> loading{false};
+  std::atomic<float> load_progress{1.f};
+  int resample_quality = RESAMPLE_FASTEST;
+  bool native_rate = true;
+  int interpolation = INTERPOLATION_CUBIC;
+  // loop points are fractions of what a voice plays, the whole file or its
+  // slice, and the crossfade is a fraction of the loop
+  int loop_mode = LOOP_OFF;
+  float loop_start = 0.f;
+  float loop_end = 1.f;
+  float loop_crossfade = 0.f;
+  // 1 or -1, ping-pong loops play backwards every other pass
+  int direction[MAX_POLY] = {0};
   float phase[MAX_POLY] = {0.0f};
+  // per voice values gathered by the playback loops, written out four
+  // voices at a time by write_outputs()
+  float voice_left[MAX_POLY] = {0.0f};
+  float voice_right[MAX_POLY] = {0.0f};
+  float voice_phase[MAX_POLY] = {0.0f};
+  float voice_rate[MAX_POLY] = {0.0f};
   CVRange phase_range;
   float gain = 1.f;
+  // streaming is the menu setting, streamed is set by the loader once the
+  // stream is open and is what process() goes by, so the audio thread never
+  // reads a stream that isn't ready
+  std::atomic<bool> streaming{false};
+  std::atomic<bool> streamed{false};
+  SampleStream stream;
 
   Polyplay()
   {
@@ -62,6 +129,11 @@ struct Polyplay : Module
     getParamQuantity(POLY_PARAM)->snapEnabled = true;
     configParam(TRIGGER_PARAM, 0.0, 1.0, 0.0, "trigger");
     configInput(TRIGGER_INPUT, "trigger");
+    configInput(VOCT_INPUT, "v/oct");
+    configInput(SLICE_INPUT, "slice select");
+    waveform_data.backgroundColor = nvgRGB(0x1a, 0x1a, 0x1a);
+    waveform_data.waveColor = nvgRGB(0xa0, 0xa0, 0xa0);
+    waveform_data.playheadColor = nvgRGB(0xff, 0xff, 0xff);
     configOutput(LEFT_OUTPUT, "left/mono");
     configOutput(RIGHT_OUTPUT, "right");
     configOutput(PHASE_OUTPUT, "phase");
@@ -80,141 +152,600 @@ struct Polyplay : Module
     }
   }
 
-  void resample_file(AudioFile<float> &file, int new_sample_rate)
-  {
-    int curr_sample_rate = file.getSampleRate();
-    int curr_num_samples = file.getNumSamplesPerChannel();
-    int curr_num_channels = file.getNumChannels();
-    int new_num_samples = (int)((float)curr_num_samples * (float)new_sample_rate / (float)curr_sample_rate);
-    int processed_samples = 0;
-    AudioFile<float> new_file;
-    new_file.setBitDepth(file.getBitDepth());
-    new_file.setSampleRate(new_sample_rate);
-    new_file.setNumChannels(curr_num_channels);
-    new_file.setNumSamplesPerChannel(new_num_samples);
-    float *data = new float[new_num_samples];
-    for (int i = 0; i < curr_num_channels; i++)
-    {
-      src = src_new(SRC_SINC_FASTEST, 1, NULL);
+  // converts one channel in chunks, so progress can be reported as it goes.
+  // libsamplerate counts frames in longs, which are 32 bits on windows, so
+  // each chunk is kept short and positions are tracked in 64 bits here.
+  // returns the number of frames written to out
+  static int64_t resample_channel(const float *in, int64_t in_frames, float *out, int64_t out_frames, double ratio, int converter, std::atomic<int64_t> *frames_done)
+  {
+    const int64_t chunk_frames = 65536;
+    int64_t in_pos = 0;
+    int64_t out_pos = 0;
+    int error = 0;
+    SRC_STATE *src = src_new(converter, 1, &error);
+    if (!src)
+    {
+      return 0;
+    }
+    while (out_pos < out_frames)
+    {
       SRC_DATA src_data;
-      src_data.end_of_input = 1;
-      src_data.data_in = file.samples[i].data();
-      src_data.data_out = data;
-      src_data.input_frames = curr_num_samples;
-      src_data.output_frames = new_num_samples;
-      src_data.src_ratio = (double)new_sample_rate / (double)curr_sample_rate;
-      src_process(src, &src_data);
-      processed_samples = src_data.output_frames_gen;
-      for (int j = 0; j < processed_samples; j++)
+      src_data.data_in = in + in_pos;
+      src_data.input_frames = (long)std::min(chunk_frames, in_frames - in_pos);
+      src_data.data_out = out + out_pos;
+      src_data.output_frames = (long)std::min<int64_t>((int64_t)(chunk_frames * ratio) + 16, out_frames - out_pos);
+      src_data.end_of_input = in_pos + src_data.input_frames >= in_frames;
+      src_data.src_ratio = ratio;
+      if (src_process(src, &src_data) != 0)
       {
-        new_file.samples[i][j] = data[j];
+        break;
       }
-      src_delete(src);
-    }
-    new_file.setAudioBufferSize(curr_num_channels, processed_samples);
-    delete[] data;
-    file = new_file;
-    file_sample_rate = new_file.getSampleRate();
-    num_channels = new_file.getNumChannels();
-    num_samples = new_file.getNumSamplesPerChannel();
+      in_pos += src_data.input_frames_used;
+      out_pos += src_data.output_frames_gen;
+      *frames_done += src_data.input_frames_used;
+      if (src_data.end_of_input && src_data.output_frames_gen == 0)
+      {
+        break;
+      }
+    }
+    src_delete(src);
+    return out_pos;
+  }
+
+  // every channel gets its own converter and thread, and writes straight
+  // into its slot of the resampled buffer
+  static void resample(SampleData &data, int new_sample_rate, int quality, std::atomic<float> *progress)
+  {
+    static const int converters[RESAMPLE_QUALITIES_LEN] = {SRC_SINC_FASTEST, SRC_SINC_MEDIUM_QUALITY, SRC_SINC_BEST_QUALITY};
+    int converter = converters[clamp(quality, 0, RESAMPLE_QUALITIES_LEN - 1)];
+    double ratio = (double)new_sample_rate / (double)data.sample_rate;
+    int channels = data.buffer.channels;
+    int64_t length = data.buffer.length;
+    int64_t new_length = (int64_t)((double)length * ratio);
+    SampleBuffer resampled;
+    resampled.allocate(channels, new_length);
+    std::vector<int64_t> generated(channels, 0);
+    std::atomic<int64_t> frames_done{0};
+    std::atomic<int> channels_done{0};
+    int64_t frames_total = length * channels;
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < channels; i++)
+    {
+      workers.emplace_back([&, i]()
+                           {
+                             generated[i] = resample_channel(data.buffer.channel(i), length, resampled.channel(i), new_length, ratio, converter, &frames_done);
+                             channels_done++; });
+    }
+    while (progress && channels_done < channels)
+    {
+      *progress = (float)frames_done / (float)frames_total;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    for (std::thread &worker : workers)
+    {
+      worker.join();
+    }
+
+    for (int64_t frames : generated)
+    {
+      resampled.truncate(frames);
+    }
+    data.buffer = std::move(resampled);
+    data.sample_rate = new_sample_rate;
+  }
+
+  // decodes a file and converts it to the given rate, or leaves it at its own
+  // rate if sample_rate is 0. used by the shared sample cache when no other
+  // instance has the file loaded at that rate
+  static bool load_sample(const std::string &path, int sample_rate, int quality, std::atomic<float> *progress, SampleData &data)
+  {
+    // this runs on the loader thread, where nothing else would catch a file
+    // that asks for more memory than there is. it fails the load instead
+    try
+    {
+      if (FlacDecoder::is_flac(path))
+      {
+        FlacDecoder flac;
+        if (!flac.load(path, data.buffer, progress))
+        {
+          return false;
+        }
+        data.sample_rate = flac.sample_rate;
+      }
+      else if (!load_pcm(path, data))
+      {
+        return false;
+      }
+      if (sample_rate > 0 && data.sample_rate != sample_rate)
+      {
+        resample(data, sample_rate, quality, progress);
+      }
+      data.slices = OnsetSlicer().slice(data.buffer, data.sample_rate);
+      data.peaks.build(data.buffer);
+      return true;
+    }
+    catch (const std::exception &e)
+    {
+      WARN("polyplay: couldn't load %s: %s", path.c_str(), e.what());
+      return false;
+    }
+  }
+
+  // wav and aiff files go through AudioFile
+  static bool load_pcm(const std::string &path, SampleData &data)
+  {
+    AudioFile<float> file;
+    if (!file.load(path))
+    {
+      return false;
+    }
+    int channels = file.getNumChannels();
+    int length = file.getNumSamplesPerChannel();
+    if (channels == 0 || length == 0)
+    {
+      return false;
+    }
+    data.sample_rate = file.getSampleRate();
+    data.buffer.allocate(channels, length);
+    for (int c = 0; c < channels; c++)
+    {
+      std::copy(file.samples[c].begin(), file.samples[c].end(), data.buffer.channel(c));
+    }
+    file.samples.clear();
+    return true;
   }
 
   void load_from_file()
   {
-    load_success = my_file.load(file_path);
+    // flac can't be read from disk a piece at a time, so it always loads
+    // into memory
+    if (streaming && FlacDecoder::is_flac(file_path))
+    {
+      streamed = false;
+      stream.close();
+      streaming = false;
+    }
+    if (streaming)
+    {
+      load_stream();
+      return;
+    }
+    streamed = false;
+    stream.close();
+    int sample_rate = native_rate ? 0 : rack_sample_rate;
+    int quality = resample_quality;
+    load_progress = 0.f;
+    SampleRef sample = sample_cache().get(file_path, sample_rate, quality, [=](SampleData &data)
+                                          { return load_sample(file_path, sample_rate, quality, &load_progress, data); });
+    load_progress = 1.f;
+    publish_sample(sample);
+    load_success = (bool)sample;
     if (load_success)
     {
       file_loaded = true;
       loaded_file_name = file_path;
-      file_sample_rate = my_file.getSampleRate();
-      num_samples = my_file.getNumSamplesPerChannel();
-      num_channels = my_file.getNumChannels();
-      if (file_sample_rate != rack_sample_rate)
-      {
-        resample_file(my_file, rack_sample_rate);
-      }
+      file_sample_rate = sample->sample_rate;
+      num_samples = sample->buffer.length;
+      num_channels = sample->buffer.channels;
     }
     else
     {
       file_loaded = false;
     }
     file_path = "";
+    loading = false;
     process_audio = true;
   }
 
-  void process(const ProcessArgs &args) override
+  // streaming mode only keeps a preroll of the file in memory and plays it
+  // at its own sample rate, so there is nothing to resample
+  void load_stream()
   {
-    rack_sample_rate = args.sampleRate;
-    if (!process_audio)
+    publish_sample(nullptr);
+    streamed = false;
+    load_success = stream.open(file_path);
+    streamed = load_success;
+    if (load_success)
+    {
+      file_loaded = true;
+      loaded_file_name = file_path;
+      file_sample_rate = stream.sample_rate;
+      num_samples = stream.num_frames;
+      num_channels = stream.num_channels;
+    }
+    else
+    {
+      file_loaded = false;
+    }
+    file_path = "";
+    loading = false;
+    process_audio = true;
+  }
+
+  // in memory samples are swapped in while the old one keeps playing, only
+  // loads that involve the disk stream have to silence the module
+  void load_file(std::string path)
+  {
+    std::lock_guard<std::mutex> mg(lock_thread_mutex);
+    if (load_thread)
+    {
+      load_thread->join();
+    }
+    file_path = path;
+    loading = true;
+    if (streaming || streamed)
+    {
+      process_audio = false;
+      for (int i = 0; i < MAX_POLY; i++)
+      {
+        playing[i] = false;
+        position[i] = 0.0;
+      }
+      current_poly_channel = 0;
+    }
+    load_thread = std::make_unique<std::thread>([this]()
+                                                { this->load_from_file(); });
+  }
+
+  // makes a sample the one new voices start on. the previous one is kept
+  // alive until no voice is reading it anymore
+  void publish_sample(SampleRef sample)
+  {
+    std::lock_guard<std::mutex> lock(held_samples_mutex);
+    if (sample)
+    {
+      held_samples.push_back(sample);
+    }
+    published_sample = sample.get();
+    release_unused_samples();
+  }
+
+  // called off the audio thread with held_samples_mutex locked
+  void release_unused_samples()
+  {
+    for (auto it = held_samples.begin(); it != held_samples.end();)
+    {
+      const SampleData *data = it->get();
+      bool in_use = data == published_sample || data == active_sample;
+      for (int i = 0; i < MAX_POLY; i++)
+      {
+        in_use |= data == voice_sample[i];
+      }
+      if (in_use)
+      {
+        ++it;
+      }
+      else
+      {
+        it = held_samples.erase(it);
+      }
+    }
+  }
+
+  // called from the widget, points the waveform display at the peaks of the
+  // sample new voices start on
+  void update_waveform()
+  {
+    if (waveform_sample.get() == published_sample)
     {
       return;
     }
-    int poly = params[POLY_PARAM].getValue();
-    outputs[PHASE_OUTPUT].setChannels(poly);
-    outputs[LEFT_OUTPUT].setChannels(poly);
-    outputs[RIGHT_OUTPUT].setChannels(poly);
+    std::lock_guard<std::mutex> lock(held_samples_mutex);
+    waveform_sample = nullptr;
+    for (SampleRef &held : held_samples)
+    {
+      if (held.get() == published_sample)
+      {
+        waveform_sample = held;
+      }
+    }
+    waveform_data.peaks = waveform_sample ? &waveform_sample->peaks : nullptr;
+  }
 
-    if (button_trigger.process(params[TRIGGER_PARAM].getValue() || input_trigger.process(inputs[TRIGGER_INPUT].getVoltage())))
+  void release_samples()
+  {
+    std::lock_guard<std::mutex> lock(held_samples_mutex);
+    // after unloading nothing is published, and the last sample goes once
+    // its voices have stopped
+    if (held_samples.size() > (published_sample ? 1u : 0u))
+    {
+      release_unused_samples();
+    }
+  }
+
+  // hands a voice the published sample. active_sample is set and the
+  // published pointer checked again, so the loader can't release a sample
+  // between this thread reading it and marking it as in use
+  void start_voice(int channel)
+  {
+    const SampleData *data = published_sample;
+    while (true)
     {
-      if (load_success)
+      active_sample = data;
+      const SampleData *check = published_sample;
+      if (check == data)
       {
-        playing[current_poly_channel] = true;
-        current_wav_sample[current_poly_channel] = 0;
-        current_poly_channel = (current_poly_channel + 1) % poly;
+        break;
+      }
+      data = check;
+    }
+    voice_sample[channel] = data;
+    active_sample = nullptr;
+    playing[channel] = data != nullptr;
+    if (!data)
+    {
+      return;
+    }
+    // 0v to 10v on the slice input picks a slice, the voice plays just that
+    // slice instead of the whole file
+    voice_start[channel] = 0;
+    voice_end[channel] = data->buffer.length;
+    int slices = (int)data->slices.size();
+    if (inputs[SLICE_INPUT].isConnected() && slices > 1)
+    {
+      int slice = clamp((int)(inputs[SLICE_INPUT].getPolyVoltage(channel) / 10.f * slices), 0, slices - 1);
+      voice_start[channel] = data->slices[slice];
+      voice_end[channel] = slice + 1 < slices ? data->slices[slice + 1] : data->buffer.length;
+    }
+    position[channel] = voice_start[channel];
+    direction[channel] = 1;
+  }
+
+  // playback speed of each voice, ratio scaled by the v/oct input
+  void update_rates(int poly, float ratio)
+  {
+    bool voct_connected = inputs[VOCT_INPUT].isConnected();
+    for (int c = 0; c < poly; c += 4)
+    {
+      simd::float_4 rate = ratio;
+      if (voct_connected)
+      {
+        rate *= dsp::approxExp2_taylor5(inputs[VOCT_INPUT].getPolyVoltageSimd<simd::float_4>(c));
       }
+      rate.store(voice_rate + c);
+    }
+  }
+
+  void write_outputs(int poly)
+  {
+    for (int c = 0; c < poly; c += 4)
+    {
+      outputs[LEFT_OUTPUT].setVoltageSimd(simd::float_4::load(voice_left + c) * gain, c);
+      outputs[RIGHT_OUTPUT].setVoltageSimd(simd::float_4::load(voice_right + c) * gain, c);
+      outputs[PHASE_OUTPUT].setVoltageSimd(simd::float_4::load(voice_phase + c), c);
     }
+  }
 
+  void process_stream(int poly)
+  {
+    bool phase_connected = outputs[PHASE_OUTPUT].isConnected();
+    bool stereo = outputs[LEFT_OUTPUT].isConnected() && outputs[RIGHT_OUTPUT].isConnected();
+    bool mono = outputs[LEFT_OUTPUT].isConnected() && !outputs[RIGHT_OUTPUT].isConnected();
+    float mono_scale = num_channels > 1 ? 0.5f : 1.f;
+    // let go of any in memory samples left over from before streaming
+    for (int i = 0; i < MAX_POLY; i++)
+    {
+      if (voice_sample[i].load(std::memory_order_relaxed))
+      {
+        voice_sample[i] = nullptr;
+      }
+    }
     for (int i = 0; i < poly; i++)
     {
+      float out_left = 0.f;
+      float out_right = 0.f;
+      float out_phase = 0.f;
       if (file_loaded && playing[i])
       {
-        phase[i] = (float)current_wav_sample[i] / (float)num_samples;
-        if (outputs[PHASE_OUTPUT].isConnected())
+        float left, right;
+        if (!stream.next(i, voice_rate[i], left, right))
         {
-          float phase_out = phase_range.map(phase[i]);
-          outputs[PHASE_OUTPUT].setVoltage(phase_out, i);
+          playing[i] = false;
+          stream.stop(i);
+        }
+        position[i] = (double)stream.voices[i].position;
+        phase[i] = playing[i] ? (float)(position[i] / num_samples) : 0.0f;
+        waveform_data.playheads[i].store(playing[i] ? phase[i] : -1.f, std::memory_order_relaxed);
+        if (phase_connected)
+        {
+          out_phase = phase_range.map(phase[i]);
+        }
+        if (stereo)
+        {
+          out_left = left;
+          out_right = right;
         }
-        if (current_wav_sample[i] >= num_samples)
+        else if (mono)
+        {
+          out_left = num_channels > 1 ? (left + right) * mono_scale : left;
+        }
+      }
+      voice_left[i] = out_left;
+      voice_right[i] = out_right;
+      voice_phase[i] = out_phase;
+      if (!playing[i])
+      {
+        waveform_data.playheads[i].store(-1.f, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // channel_scale is 1 / the number of channels, worked out once per voice
+  void read_frame(const SampleBuffer &buffer, float channel_scale, double frame, double step, bool stereo, bool mono, float &left, float &right)
+  {
+    if (stereo)
+    {
+      left = Interpolator::read(interpolation, buffer.channel(0), buffer.length, frame, step);
+      right = buffer.channels > 1 ? Interpolator::read(interpolation, buffer.channel(1), buffer.length, frame, step) : left;
+    }
+    else if (mono)
+    {
+      left = 0.f;
+      for (int j = 0; j < buffer.channels; j++)
+      {
+        left += Interpolator::read(interpolation, buffer.channel(j), buffer.length, frame, step);
+      }
+      left *= channel_scale;
+    }
+  }
+
+  void process_memory(int poly, float sample_time)
+  {
+    bool phase_connected = outputs[PHASE_OUTPUT].isConnected();
+    bool stereo = outputs[LEFT_OUTPUT].isConnected() && outputs[RIGHT_OUTPUT].isConnected();
+    bool mono = outputs[LEFT_OUTPUT].isConnected() && !outputs[RIGHT_OUTPUT].isConnected();
+    for (int i = 0; i < poly; i++)
+    {
+      float out_left = 0.f;
+      float out_right = 0.f;
+      float out_phase = 0.f;
+      const SampleData *data = voice_sample[i].load(std::memory_order_relaxed);
+      if (data && playing[i])
+      {
+        const SampleBuffer &buffer = data->buffer;
+        float channel_scale = 1.f / buffer.channels;
+        double length = voice_end[i] - voice_start[i];
+        phase[i] = (float)((position[i] - voice_start[i]) / length);
+        if (phase_connected)
+        {
+          out_phase = phase_range.map(phase[i]);
+        }
+        if (loop_mode == LOOP_OFF && position[i] >= voice_end[i])
         {
           playing[i] = false;
           phase[i] = 0.0f;
         }
-        if (outputs[LEFT_OUTPUT].isConnected() && outputs[RIGHT_OUTPUT].isConnected())
+        double step = voice_rate[i] * data->sample_rate * sample_time;
+        read_frame(buffer, channel_scale, position[i], step, stereo, mono, out_left, out_right);
+
+        if (loop_mode == LOOP_OFF)
+        {
+          position[i] += step;
+        }
+        else
         {
-          if (num_channels > 1)
+          double start = voice_start[i] + length * std::min(loop_start, loop_end);
+          double end = std::min(voice_start[i] + length * std::max(loop_start, loop_end), (double)voice_end[i]);
+          end = std::max(end, std::min(start + LOOP_MIN_FRAMES, (double)voice_end[i]));
+          double loop_length = end - start;
+          if (loop_mode == LOOP_FORWARD)
           {
-            outputs[LEFT_OUTPUT].setVoltage(my_file.samples[0][current_wav_sample[i]] * gain, i);
-            outputs[RIGHT_OUTPUT].setVoltage(my_file.samples[1][current_wav_sample[i]] * gain, i);
+            // the end of the loop fades into the audio leading up to its
+            // start, so the jump back lands where the fade left off
+            double fade = std::min(loop_length * loop_crossfade, start);
+            if (fade > 0.0 && position[i] > end - fade)
+            {
+              float x = (float)((position[i] - (end - fade)) / fade);
+              float in_left = 0.f;
+              float in_right = 0.f;
+              read_frame(buffer, channel_scale, position[i] - loop_length, step, stereo, mono, in_left, in_right);
+              const CrossfadeTable &table = crossfade_table();
+              float gain_out = table.fade_out(x);
+              float gain_in = table.fade_in(x);
+              out_left = out_left * gain_out + in_left * gain_in;
+              out_right = out_right * gain_out + in_right * gain_in;
+            }
+            position[i] += step;
+            if (position[i] >= end && loop_length > 0.0)
+            {
+              position[i] = start + std::fmod(position[i] - start, loop_length);
+            }
           }
           else
           {
-            outputs[LEFT_OUTPUT].setVoltage(my_file.samples[0][current_wav_sample[i]] * gain, i);
-            outputs[RIGHT_OUTPUT].setVoltage(my_file.samples[0][current_wav_sample[i]] * gain, i);
+            position[i] += step * direction[i];
+            if (position[i] >= end)
+            {
+              position[i] = std::max(start, 2.0 * end - position[i]);
+              direction[i] = -1;
+            }
+            else if (position[i] < start && direction[i] < 0)
+            {
+              position[i] = std::min(end, 2.0 * start - position[i]);
+              direction[i] = 1;
+            }
           }
         }
-        else if (outputs[LEFT_OUTPUT].isConnected() && !outputs[RIGHT_OUTPUT].isConnected())
+        waveform_data.playheads[i].store(playing[i] ? (float)(position[i] / buffer.length) : -1.f, std::memory_order_relaxed);
+      }
+      voice_left[i] = out_left;
+      voice_right[i] = out_right;
+      voice_phase[i] = out_phase;
+      if (!playing[i])
+      {
+        waveform_data.playheads[i].store(-1.f, std::memory_order_relaxed);
+        // voices stopped by unloading let go of their sample here, on the
+        // thread that reads it
+        if (data)
         {
-          float output_sample = 0;
-          for (int j = 0; j < num_channels; j++)
-          {
-            output_sample += my_file.samples[j][current_wav_sample[i]];
-          }
-          output_sample /= num_channels;
-          outputs[LEFT_OUTPUT].setVoltage(output_sample * gain, i);
+          voice_sample[i] = nullptr;
         }
-        current_wav_sample[i]++;
+      }
+    }
+  }
+
+  void process(const ProcessArgs &args) override
+  {
+    rack_sample_rate = args.sampleRate;
+    if (!process_audio)
+    {
+      return;
+    }
+    int poly = params[POLY_PARAM].getValue();
+    outputs[PHASE_OUTPUT].setChannels(poly);
+    outputs[LEFT_OUTPUT].setChannels(poly);
+    outputs[RIGHT_OUTPUT].setChannels(poly);
+    bool stream_ready = streamed;
+
+    if (button_trigger.process(params[TRIGGER_PARAM].getValue() || input_trigger.process(inputs[TRIGGER_INPUT].getVoltage())))
+    {
+      if (stream_ready)
+      {
+        playing[current_poly_channel] = true;
+        position[current_poly_channel] = 0.0;
+        stream.start(current_poly_channel);
+        current_poly_channel = (current_poly_channel + 1) % poly;
       }
       else
       {
-        outputs[PHASE_OUTPUT].setVoltage(0.0f, i);
-        outputs[LEFT_OUTPUT].setVoltage(0, i);
-        outputs[RIGHT_OUTPUT].setVoltage(0, i);
+        start_voice(current_poly_channel);
+        current_poly_channel = (current_poly_channel + 1) % poly;
+      }
+    }
+
+    if (stream_ready)
+    {
+      update_rates(poly, (float)file_sample_rate / args.sampleRate);
+      process_stream(poly);
+    }
+    else
+    {
+      update_rates(poly, 1.f);
+      process_memory(poly, args.sampleTime);
+    }
+    write_outputs(poly);
+    for (int i = poly; i < MAX_POLY; i++)
+    {
+      waveform_data.playheads[i].store(-1.f, std::memory_order_relaxed);
+      // turning the poly knob down stops the voices above it
+      if (voice_sample[i].load(std::memory_order_relaxed))
+      {
+        playing[i] = false;
+        voice_sample[i] = nullptr;
       }
     }
   }
 
   void onReset() override
   {
+    // reset runs with the engine paused, so the voices can drop their
+    // samples here before they're released
+    for (int i = 0; i < MAX_POLY; i++)
+    {
+      voice_sample[i] = nullptr;
+    }
+    publish_sample(nullptr);
     file_loaded = false;
     load_success = false;
     loaded_file_name = "";
@@ -223,19 +754,19 @@ struct Polyplay : Module
     num_samples = 0;
     num_channels = 0;
     current_poly_channel = 0;
-    for (int i = 0; i < 16; i++)
+    for (int i = 0; i < MAX_POLY; i++)
     {
       playing[i] = false;
-      current_wav_sample[i] = 0;
+      position[i] = 0.0;
     }
   }
 
   void onSampleRateChange() override
   {
     rack_sample_rate = APP->engine->getSampleRate();
-    if (file_loaded)
+    if (file_loaded && !streaming && !native_rate)
     {
-      resample_file(my_file, rack_sample_rate);
+      load_file(loaded_file_name);
     }
   }
 
@@ -245,6 +776,14 @@ struct Polyplay : Module
     json_object_set_new(rootJ, "loaded_file_name", json_string(loaded_file_name.c_str()));
     json_object_set_new(rootJ, "file_loaded", json_boolean(file_loaded));
     json_object_set_new(rootJ, "phase_range", phase_range.dataToJson());
+    json_object_set_new(rootJ, "streaming", json_boolean(streaming));
+    json_object_set_new(rootJ, "resample_quality", json_integer(resample_quality));
+    json_object_set_new(rootJ, "native_rate", json_boolean(native_rate));
+    json_object_set_new(rootJ, "interpolation", json_integer(interpolation));
+    json_object_set_new(rootJ, "loop_mode", json_integer(loop_mode));
+    json_object_set_new(rootJ, "loop_start", json_real(loop_start));
+    json_object_set_new(rootJ, "loop_end", json_real(loop_end));
+    json_object_set_new(rootJ, "loop_crossfade", json_real(loop_crossfade));
     return rootJ;
   }
 
@@ -260,32 +799,50 @@ struct Polyplay : Module
     {
       file_loaded = json_boolean_value(file_loadedJ);
     }
+    json_t *streamingJ = json_object_get(rootJ, "streaming");
+    if (streamingJ)
+    {
+      streaming = json_boolean_value(streamingJ);
+    }
+    json_t *resample_qualityJ = json_object_get(rootJ, "resample_quality");
+    if (resample_qualityJ)
+    {
+      resample_quality = json_integer_value(resample_qualityJ);
+    }
+    // patches from before native rate playback was added were resampled
+    // on load, and keep playing that way
+    json_t *native_rateJ = json_object_get(rootJ, "native_rate");
+    native_rate = native_rateJ ? json_boolean_value(native_rateJ) : false;
+    json_t *interpolationJ = json_object_get(rootJ, "interpolation");
+    if (interpolationJ)
+    {
+      interpolation = clamp((int)json_integer_value(interpolationJ), 0, INTERPOLATION_MODES_LEN - 1);
+    }
+    json_t *loop_modeJ = json_object_get(rootJ, "loop_mode");
+    if (loop_modeJ)
+    {
+      loop_mode = clamp((int)json_integer_value(loop_modeJ), 0, LOOP_MODES_LEN - 1);
+    }
+    json_t *loop_startJ = json_object_get(rootJ, "loop_start");
+    if (loop_startJ)
+    {
+      loop_start = clamp((float)json_number_value(loop_startJ), 0.f, 1.f);
+    }
+    json_t *loop_endJ = json_object_get(rootJ, "loop_end");
+    if (loop_endJ)
+    {
+      loop_end = clamp((float)json_number_value(loop_endJ), 0.f, 1.f);
+    }
+    json_t *loop_crossfadeJ = json_object_get(rootJ, "loop_crossfade");
+    if (loop_crossfadeJ)
+    {
+      loop_crossfade = clamp((float)json_number_value(loop_crossfadeJ), 0.f, LOOP_MAX_CROSSFADE);
+    }
+    // decode on the load thread so the patch doesn't wait on it,
+    // process() stays silent until the sample is ready
     if (file_loaded)
     {
-      load_success = my_file.load(loaded_file_name);
-      if (load_success)
-      {
-      file_sample_rate = my_file.getSampleRate();
-      num_samples = my_file.getNumSamplesPerChannel();
-      num_channels = my_file.getNumChannels();
-        if (file_sample_rate != rack_sample_rate)
-        {
-          resample_file(my_file, rack_sample_rate);
-        }
-      }
-      else
-      {
-        file_loaded = false;
-        loaded_file_name = "";
-        file_sample_rate = 0;
-        num_samples = 0;
-        num_channels = 0;
-      for (int i = 0; i < MAX_POLY; i++)
-      {
-          playing[i] = false;
-        current_wav_sample[i] = 0;
-        }
-      }
+      load_file(loaded_file_name);
     }
     json_t *phase_rangeJ = json_object_get(rootJ, "phase_range");
     if (phase_rangeJ)
@@ -319,12 +876,19 @@ struct PolyplayWidget : ModuleWidget
     float x = x_start;
     float y = y_start;
 
+    auto waveform = new Waveform(module ? &module->waveform_data : nullptr);
+    waveform->box.pos = Vec(RACK_GRID_WIDTH * 0.45f, RACK_GRID_WIDTH * 3.4f);
+    waveform->box.size = Vec(box.size.x - RACK_GRID_WIDTH * 0.9f, RACK_GRID_WIDTH);
+    addChild(waveform);
+
     addParam(createParamCentered<BitKnob>(Vec(x, y), module, Polyplay::POLY_PARAM));
-    y += dy * 2 - RACK_GRID_WIDTH;
-    addParam(createParamCentered<TL1105>(Vec(x, y), module, Polyplay::TRIGGER_PARAM));
-    y += dy - RACK_GRID_WIDTH / 2;
-    addInput(createInputCentered<BitPort>(Vec(x, y), module, Polyplay::TRIGGER_INPUT));
-    y += dy * 2 - RACK_GRID_WIDTH / 4;
+    y += dy + RACK_GRID_WIDTH / 2;
+    addParam(createParamCentered<TL1105>(Vec(x - RACK_GRID_WIDTH * 0.85f, y), module, Polyplay::TRIGGER_PARAM));
+    addInput(createInputCentered<BitPort>(Vec(x + RACK_GRID_WIDTH * 0.85f, y), module, Polyplay::SLICE_INPUT));
+    y += dy + RACK_GRID_WIDTH * 0.41f;
+    addInput(createInputCentered<BitPort>(Vec(x - RACK_GRID_WIDTH * 0.85f, y), module, Polyplay::TRIGGER_INPUT));
+    addInput(createInputCentered<BitPort>(Vec(x + RACK_GRID_WIDTH * 0.85f, y), module, Polyplay::VOCT_INPUT));
+    y += dy * 2 - RACK_GRID_WIDTH * 0.66f;
     addOutput(createOutputCentered<BitPort>(Vec(x, y), module, Polyplay::PHASE_OUTPUT));
     y += dy * 2 + RACK_GRID_WIDTH / 4;
     addOutput(createOutputCentered<BitPort>(Vec(x, y), module, Polyplay::LEFT_OUTPUT));
@@ -356,6 +920,8 @@ struct PolyplayWidget : ModuleWidget
       }
       svgPanel->fb->dirty = true;
     }
+    playModule->release_samples();
+    playModule->update_waveform();
     ModuleWidget::step();
   }
 
@@ -416,6 +982,73 @@ struct PolyplayWidget : ModuleWidget
     }
   };
 
+  struct LoopQuantity : Quantity
+  {
+    float *value;
+    float max_value;
+    std::string label;
+
+    LoopQuantity(float *value, float max_value, std::string label)
+    {
+      this->value = value;
+      this->max_value = max_value;
+      this->label = label;
+    }
+
+    void setValue(float value) override
+    {
+      *this->value = clamp(value, 0.f, max_value);
+    }
+
+    float getValue() override
+    {
+      return *value;
+    }
+
+    float getMinValue() override
+    {
+      return 0.f;
+    }
+
+    float getMaxValue() override
+    {
+      return max_value;
+    }
+
+    float getDisplayValue() override
+    {
+      return getValue() * 100.f;
+    }
+
+    void setDisplayValue(float displayValue) override
+    {
+      setValue(displayValue / 100.f);
+    }
+
+    std::string getLabel() override
+    {
+      return label;
+    }
+
+    std::string getUnit() override
+    {
+      return "%";
+    }
+  };
+
+  struct LoopSlider : ui::Slider
+  {
+    LoopSlider(float *value, float max_value, std::string label)
+    {
+      quantity = new LoopQuantity(value, max_value, label);
+      box.size.x = 200.f;
+    }
+    ~LoopSlider()
+    {
+      delete quantity;
+    }
+  };
+
   void appendContextMenu(Menu *menu) override
   {
     Polyplay *module = dynamic_cast<Polyplay *>(this->module);
@@ -455,31 +1088,61 @@ struct PolyplayWidget : ModuleWidget
       Polyplay *module;
       void onAction(const event::Action &e) override
       {
-        char *path = osdialog_file(OSDIALOG_OPEN, "", NULL, NULL);
+        osdialog_filters *filters = osdialog_filters_parse("Audio:wav,WAV,aif,aiff,AIF,AIFF,flac,FLAC");
+        char *path = osdialog_file(OSDIALOG_OPEN, "", NULL, filters);
+        osdialog_filters_free(filters);
         if (path)
         {
-          module->file_path = path;
-          for (int i = 0; i < MAX_POLY; i++)
-          {
-            module->playing[i] = false;
-            module->current_wav_sample[i] = 0;
-          }
-          module->current_poly_channel = 0;
-          std::lock_guard<std::mutex> mg(module->lock_thread_mutex);
-          if (module->load_thread)
-          {
-            module->load_thread->join();
-          }
-          module->process_audio = false;
-          module->load_thread = std::make_unique<std::thread>([this]()
-                                                              { this->module->load_from_file(); });
+          module->load_file(path);
           free(path);
         }
       }
     };
 
     menu->addChild(new MenuSeparator());
-    LoadWavItem *loadWavItem = createMenuItem<LoadWavItem>("load sample");
+    menu->addChild(createBoolMenuItem("stream from disk", "",
+                                      [=]()
+                                      { return module->streaming.load(); },
+                                      [=](bool streaming)
+                                      {
+                                        module->streaming = streaming;
+                                        if (module->file_loaded)
+                                        {
+                                          module->load_file(module->loaded_file_name);
+                                        }
+                                      }));
+    menu->addChild(createIndexPtrSubmenuItem("interpolation", {"linear", "cubic", "sinc"}, &module->interpolation));
+    menu->addChild(createSubmenuItem("loop", "", [=](Menu *menu)
+                                     {
+      menu->addChild(createIndexPtrSubmenuItem("mode", {"off", "forward", "ping-pong"}, &module->loop_mode));
+      menu->addChild(new MenuSeparator());
+      menu->addChild(new LoopSlider(&module->loop_start, 1.f, "start"));
+      menu->addChild(new LoopSlider(&module->loop_end, 1.f, "end"));
+      menu->addChild(new LoopSlider(&module->loop_crossfade, LOOP_MAX_CROSSFADE, "crossfade")); }));
+    menu->addChild(createBoolMenuItem("play at native rate", "",
+                                      [=]()
+                                      { return module->native_rate; },
+                                      [=](bool native_rate)
+                                      {
+                                        module->native_rate = native_rate;
+                                        if (module->file_loaded && !module->streaming)
+                                        {
+                                          module->load_file(module->loaded_file_name);
+                                        }
+                                      }));
+    menu->addChild(createIndexSubmenuItem("resample quality", {"fastest", "medium", "best"},
+                                          [=]()
+                                          { return module->resample_quality; },
+                                          [=](int quality)
+                                          {
+                                            module->resample_quality = quality;
+                                            if (module->file_loaded && !module->streaming && !module->native_rate)
+                                            {
+                                              module->load_file(module->loaded_file_name);
+                                            }
+                                          }));
+    std::string load_label = module->loading ? string::f("loading sample (%d%%)", (int)(module->load_progress * 100.f)) : "load sample";
+    LoadWavItem *loadWavItem = createMenuItem<LoadWavItem>(load_label);
     loadWavItem->module = module;
     menu->addChild(loadWavItem);
 
@@ -490,12 +1153,13 @@ struct PolyplayWidget : ModuleWidget
         Polyplay *module;
         void onAction(const event::Action &e) override
         {
+          module->publish_sample(nullptr);
           module->file_loaded = false;
           module->load_success = false;
           module->loaded_file_name = "";
           for (int i = 0; i < MAX_POLY; i++) {
               module->playing[i] = false;
-              module->current_wav_sample[i] = 0;
+              module->position[i] = 0.0;
           }
         }
       };
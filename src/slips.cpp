@@ -136,28 +136,19 @@ void Slips::dataFromJson(json_t *rootJ)
 
 void Slips::get_custom_scale()
 {
-  Slipspander *slipspander = dynamic_cast<Slipspander *>(rightExpander.module);
-  if (slipspander)
+  SlipspanderMessage *message = (SlipspanderMessage *)rightExpander.consumerMessage;
+  if (message->note_mask == custom_scale_mask)
   {
-    custom_scale_len = (int)slipspander->selected_notes.size();
-    if (custom_scale_len > 0)
-    {
-      custom_scale = new int[custom_scale_len];
-      for (int i = 0; i < custom_scale_len; i++)
-      {
-        custom_scale[i] = slipspander->selected_notes[i];
-      }
-    }
-    else
-    {
-      custom_scale_len = 0;
-      custom_scale = NULL;
-    }
+    return;
   }
-  else
+  custom_scale_mask = message->note_mask;
+  custom_scale_len = 0;
+  for (int i = 0; i < 12; i++)
   {
-    custom_scale_len = 0;
-    custom_scale = NULL;
+    if (custom_scale_mask & (1 << i))
+    {
+      custom_scale[custom_scale_len++] = i;
+    }
   }
 }
 
@@ -308,8 +299,7 @@ void Slips::process(const ProcessArgs &args)
   if (rightExpander.module && rightExpander.module->model == modelSlipspander)
   {
     expanded = true;
-    if (!was_expanded)
-      get_custom_scale();
+    get_custom_scale();
   }
   else
   {
@@ -438,7 +428,7 @@ void Slips::process(const ProcessArgs &args)
     {
       for (int c = 0; c < channels + 1; c++)
       {
-        if (expanded && custom_scale != NULL && custom_scale_len > 0)
+        if (expanded && custom_scale_len > 0)
         {
           if (c == curr_channel)
             outputs[SEQUENCE_OUTPUT].setVoltage(
@@ -472,7 +462,7 @@ void Slips::process(const ProcessArgs &args)
         {
           for (int c = 0; c < channels + 1; c++)
           {
-            if (expanded && custom_scale != NULL && custom_scale_len > 0)
+            if (expanded && custom_scale_len > 0)
             {
               if (c == curr_channel)
                 outputs[MOD_SEQUENCE_OUTPUT].setVoltage(
@@ -490,7 +480,7 @@ void Slips::process(const ProcessArgs &args)
         }
         else
         {
-          if (expanded && custom_scale != NULL && custom_scale_len > 0)
+          if (expanded && custom_scale_len > 0)
           {
             outputs[MOD_SEQUENCE_OUTPUT].setVoltage(
                 quantize(mod_out, root_note, custom_scale, custom_scale_len));
@@ -528,7 +518,7 @@ void Slips::process(const ProcessArgs &args)
     {
       for (int c = 0; c < channels + 1; c++)
       {
-        if (expanded && custom_scale != NULL && custom_scale_len > 0)
+        if (expanded && custom_scale_len > 0)
         {
           if (c == curr_channel)
             outputs[SEQUENCE_OUTPUT].setVoltage(
@@ -564,7 +554,7 @@ void Slips::process(const ProcessArgs &args)
         {
           for (int c = 0; c < channels + 1; c++)
           {
-            if (expanded && custom_scale != NULL && custom_scale_len > 0)
+            if (expanded && custom_scale_len > 0)
             {
               if (c == curr_channel)
                 outputs[MOD_SEQUENCE_OUTPUT].setVoltage(
@@ -582,7 +572,7 @@ void Slips::process(const ProcessArgs &args)
         }
         else
         {
-          if (expanded && custom_scale != NULL && custom_scale_len > 0)
+          if (expanded && custom_scale_len > 0)
           {
             outputs[MOD_SEQUENCE_OUTPUT].setVoltage(
                 quantize(mod_out, root_note, custom_scale, custom_scale_len));
@@ -628,8 +618,6 @@ void Slips::process(const ProcessArgs &args)
   }
 
   lights[EXPANDED_LIGHT].setBrightness(expanded ? 1.f : 0.f);
-
-  was_expanded = expanded;
 }
 
 void SlipsWidget::step()
@@ -96,12 +96,20 @@ struct Slips : Module, Quantizer
     configOutput(MOD_SEQUENCE_OUTPUT, "mod sequence");
     generate_sequence();
     generate_mod_sequence();
+    rightExpander.producerMessage = new SlipspanderMessage;
+    rightExpander.consumerMessage = new SlipspanderMessage;
     if (use_global_contrast[SLIPS])
     {
       module_contrast[SLIPS] = global_contrast;
     }
   }
 
+  ~Slips()
+  {
+    delete (SlipspanderMessage *)rightExpander.producerMessage;
+    delete (SlipspanderMessage *)rightExpander.consumerMessage;
+  }
+
   std::vector<float> the_sequence = std::vector<float>(MAX_STEPS, 0.0f);
   std::vector<float> mod_sequence = std::vector<float>(MAX_STEPS, 0.0f);
   std::vector<float> the_slips = std::vector<float>(MAX_STEPS, 0.0f);
@@ -119,9 +127,9 @@ struct Slips : Module, Quantizer
   bool root_input_voct = false;
   bool skip_step = false;
   bool expanded = false;
-  bool was_expanded = false;
-  int *custom_scale = NULL;
+  int custom_scale[12] = {0};
   int custom_scale_len = 0;
+  int custom_scale_mask = -1;
   int starting_step = 0;
   int last_starting_step = 0;
   int channels = 0;
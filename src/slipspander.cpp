@@ -1,34 +1,24 @@
 #include "plugin.hpp"
 #include "slipspander.hpp"
-#include "slips.hpp"
 
 void Slipspander::process(const ProcessArgs &args)
 {
-  selected_notes.clear();
+  uint16_t note_mask = 0;
   for (int i = 0; i < 12; i++)
   {
-    if (params[C_PARAM + i].getValue() > 0.5f)
+    notes_on[i] = params[C_PARAM + i].getValue() > 0.5f;
+    if (notes_on[i])
     {
-      notes_on[i] = true;
-      selected_notes.push_back(i);
-    }
-    else
-    {
-      notes_on[i] = false;
+      note_mask |= 1 << i;
     }
   }
 
   if (leftExpander.module && leftExpander.module->model == modelSlips)
   {
     expanding = true;
-    if (selected_notes != selected_notes_prev)
-    {
-      Slips *slipsModule = dynamic_cast<Slips *>(leftExpander.module);
-      if (slipsModule)
-      {
-        slipsModule->get_custom_scale();
-      }
-    }
+    SlipspanderMessage *message = (SlipspanderMessage *)leftExpander.module->rightExpander.producerMessage;
+    message->note_mask = note_mask;
+    leftExpander.module->rightExpander.requestMessageFlip();
   }
   else
   {
@@ -40,8 +30,6 @@ void Slipspander::process(const ProcessArgs &args)
     lights[C_LIGHT + i].setBrightness(notes_on[i] ? 1.f : 0.f);
   }
   lights[EXPANDING_LIGHT].setBrightness(expanding ? 1.f : 0.f);
-
-  selected_notes_prev = selected_notes;
 }
 
 json_t *Slipspander::dataToJson()
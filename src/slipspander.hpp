@@ -4,6 +4,13 @@
 #include "widgets/PanelBackground.hpp"
 #include "widgets/InverterWidget.hpp"
 
+// sent from slipspander to slips through the expander message buffers that
+// slips owns, one bit per note starting from C
+struct SlipspanderMessage
+{
+  uint16_t note_mask = 0;
+};
+
 struct Slipspander : Module
 {
   enum ParamId
@@ -50,8 +57,6 @@ struct Slipspander : Module
 
   bool expanding = false;
   bool notes_on[12] = {false};
-  std::vector<int> selected_notes;
-  std::vector<int> selected_notes_prev;
 
   Slipspander()
   {
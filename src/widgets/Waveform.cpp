@@ -0,0 +1,69 @@
+#include "Waveform.hpp"
+
+Waveform::Waveform(WaveformData *data) : data(data) {}
+
+void Waveform::drawBackground(const DrawArgs &args)
+{
+  if (!data)
+  {
+    return;
+  }
+
+  withFill(args, data->backgroundColor, [=]
+           { withPath(args,
+                      [=]()
+                      { nvgRoundedRect(args.vg, 0, 0, box.size.x, box.size.y, 1.5f); }); });
+}
+
+void Waveform::drawWave(const DrawArgs &args)
+{
+  if (!data || !data->peaks || data->peaks->length == 0)
+  {
+    return;
+  }
+
+  const PeakPyramid *peaks = data->peaks;
+  int columns = (int)box.size.x;
+  double frames_per_column = (double)peaks->length / columns;
+  float mid = box.size.y / 2.f;
+  withFill(args, data->waveColor, [=]()
+           { withPath(args, [=]()
+                      {
+            for (int x = 0; x < columns; x++) {
+                PeakPyramid::Peak peak = peaks->range(x * frames_per_column, (x + 1) * frames_per_column);
+                float top = mid - clamp(peak.max, -1.f, 1.f) * mid;
+                float bottom = mid - clamp(peak.min, -1.f, 1.f) * mid;
+                nvgRect(args.vg, x, top, 1.f, std::max(bottom - top, 0.5f));
+            } }); });
+}
+
+void Waveform::drawPlayheads(const DrawArgs &args)
+{
+  if (!data)
+  {
+    return;
+  }
+
+  for (int i = 0; i < MAX_POLY; i++)
+  {
+    float playhead = data->playheads[i].load(std::memory_order_relaxed);
+    if (playhead < 0.f)
+    {
+      continue;
+    }
+    float x = clamp(playhead, 0.f, 1.f) * box.size.x;
+    withStroke(args, 1.f, data->playheadColor, [=]()
+               { withPath(args, [=]()
+                          {
+                    nvgMoveTo(args.vg, x, 0);
+                    nvgLineTo(args.vg, x, box.size.y); }); });
+  }
+}
+
+void Waveform::draw(const DrawArgs &args)
+{
+  OpaqueWidget::draw(args);
+  drawBackground(args);
+  drawWave(args);
+  drawPlayheads(args);
+}
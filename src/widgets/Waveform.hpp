@@ -0,0 +1,20 @@
+#pragma once
+
+#include <rack.hpp>
+
+using namespace rack;
+
+#include "FancyWidget.hpp"
+#include "WaveformData.hpp"
+
+struct Waveform : FancyWidget
+{
+  WaveformData *data;
+
+  Waveform(WaveformData *data);
+
+  void drawBackground(const DrawArgs &args);
+  void drawWave(const DrawArgs &args);
+  void drawPlayheads(const DrawArgs &args);
+  void draw(const DrawArgs &args) override;
+};
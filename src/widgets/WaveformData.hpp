@@ -0,0 +1,27 @@
+#pragma once
+
+#include <atomic>
+#include "../inc/PeakPyramid.hpp"
+
+#define MAX_POLY 16
+
+struct WaveformData
+{
+  // set on the ui thread, the owner keeps the pyramid alive while it is shown
+  const PeakPyramid *peaks = nullptr;
+  // where each voice is, 0 to 1 through the sample, or below 0 when idle.
+  // written by the audio thread and read by the widget without locking
+  std::atomic<float> playheads[MAX_POLY];
+
+  NVGcolor backgroundColor;
+  NVGcolor waveColor;
+  NVGcolor playheadColor;
+
+  WaveformData()
+  {
+    for (int i = 0; i < MAX_POLY; i++)
+    {
+      playheads[i] = -1.f;
+    }
+  }
+};
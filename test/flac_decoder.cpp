@@ -0,0 +1,239 @@
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include "../src/inc/FlacDecoder.hpp"
+
+// FlacDecoder against streams made here: a small valid one, then copies of
+// it with the stream info damaged in the ways a broken or hostile file
+// would. none of them may throw or allocate what the header claims. the
+// decoder needs nothing from the SDK, so neither does this: `make test`
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+  std::printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+  failures += !ok;
+}
+
+struct BitWriter
+{
+  std::vector<uint8_t> bytes;
+  int bits = 0;
+
+  void write(uint32_t value, int count)
+  {
+    for (int i = count - 1; i >= 0; i--)
+    {
+      if (bits % 8 == 0)
+      {
+        bytes.push_back(0);
+      }
+      bytes.back() |= ((value >> i) & 1) << (7 - bits % 8);
+      bits++;
+    }
+  }
+
+  void align()
+  {
+    bits = (bits + 7) / 8 * 8;
+  }
+};
+
+// 16 bit stereo in fixed size blocks, every channel stored verbatim except
+// blocks_constant trailing blocks of silence stored as constant subframes
+struct TestStream
+{
+  int block_size = 256;
+  int blocks = 4;
+  int blocks_constant = 0;
+  int64_t claimed_frames = -1;
+
+  int64_t frames() const
+  {
+    return (int64_t)block_size * (blocks + blocks_constant);
+  }
+
+  int16_t sample(int channel, int64_t frame) const
+  {
+    return frame >= (int64_t)block_size * blocks ? 0 : (int16_t)((frame * 37 + channel * 1000) % 20000 - 10000);
+  }
+
+  std::vector<uint8_t> encode() const
+  {
+    BitWriter out;
+    for (char c : std::string("fLaC"))
+    {
+      out.write((uint8_t)c, 8);
+    }
+    // stream info, the last metadata block
+    out.write(0x80, 8);
+    out.write(34, 24);
+    out.write(block_size, 16);
+    out.write(block_size, 16);
+    out.write(0, 24);
+    out.write(0, 24);
+    out.write(48000, 20);
+    out.write(2 - 1, 3);
+    out.write(16 - 1, 5);
+    int64_t total = claimed_frames >= 0 ? claimed_frames : frames();
+    out.write((uint32_t)(total >> 32), 4);
+    out.write((uint32_t)total, 32);
+    for (int i = 0; i < 16; i++)
+    {
+      out.write(0, 8);
+    }
+
+    for (int b = 0; b < blocks + blocks_constant; b++)
+    {
+      size_t start = out.bytes.size();
+      out.write(0x3ffe, 14);
+      out.write(0, 1);
+      out.write(0, 1);
+      // block size in 16 bits at the end of the header, rate and bit depth
+      // from the stream info, independent stereo
+      out.write(7, 4);
+      out.write(0, 4);
+      out.write(1, 4);
+      out.write(0, 3);
+      out.write(0, 1);
+      // frame number, utf-8 style
+      if (b < 0x80)
+      {
+        out.write(b, 8);
+      }
+      else if (b < 0x800)
+      {
+        out.write(0xc0 | (b >> 6), 8);
+        out.write(0x80 | (b & 0x3f), 8);
+      }
+      else
+      {
+        out.write(0xe0 | (b >> 12), 8);
+        out.write(0x80 | ((b >> 6) & 0x3f), 8);
+        out.write(0x80 | (b & 0x3f), 8);
+      }
+      out.write(block_size - 1, 16);
+      out.write(FlacDecoder::crc8(out.bytes.data() + start, out.bytes.size() - start), 8);
+      for (int c = 0; c < 2; c++)
+      {
+        bool constant = b >= blocks;
+        out.write(0, 1);
+        out.write(constant ? 0 : 1, 6);
+        out.write(0, 1);
+        for (int i = 0; i < (constant ? 1 : block_size); i++)
+        {
+          out.write((uint16_t)sample(c, (int64_t)b * block_size + i), 16);
+        }
+      }
+      out.align();
+      out.write(FlacDecoder::crc16(out.bytes.data() + start, out.bytes.size() - start), 16);
+    }
+    return out.bytes;
+  }
+};
+
+static std::string write_file(const std::vector<uint8_t> &bytes)
+{
+  std::string path = (std::filesystem::temp_directory_path() / "alefsbits-test.flac").string();
+  std::ofstream file(path, std::ios::binary);
+  file.write((const char *)bytes.data(), bytes.size());
+  return path;
+}
+
+// loads bytes, and fails the check if anything escapes the decoder
+static bool load(const std::vector<uint8_t> &bytes, SampleBuffer &buffer, int64_t max_samples = FLAC_MAX_SAMPLES)
+{
+  FlacDecoder flac;
+  flac.max_samples = max_samples;
+  try
+  {
+    return flac.load(write_file(bytes), buffer, nullptr);
+  }
+  catch (const std::exception &e)
+  {
+    std::printf("     threw %s\n", e.what());
+    failures++;
+    return false;
+  }
+}
+
+static bool matches(const TestStream &stream, const SampleBuffer &buffer)
+{
+  if (buffer.channels != 2 || buffer.length != stream.frames())
+  {
+    return false;
+  }
+  for (int c = 0; c < 2; c++)
+  {
+    for (int64_t i = 0; i < buffer.length; i++)
+    {
+      if (buffer.channel(c)[i] * 32768.f != (float)stream.sample(c, i))
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int main()
+{
+  TestStream stream;
+  std::vector<uint8_t> valid = stream.encode();
+  // the stream info starts after the marker and the block header
+  const size_t info = 8;
+
+  {
+    SampleBuffer buffer;
+    check(load(valid, buffer) && matches(stream, buffer), "valid stream decodes exactly");
+  }
+  {
+    // 2^36 - 1 frames, far more than the file holds
+    TestStream huge = stream;
+    huge.claimed_frames = ((int64_t)1 << 36) - 1;
+    SampleBuffer buffer;
+    check(load(huge.encode(), buffer) && matches(stream, buffer), "impossible length is ignored and counted instead");
+  }
+  {
+    std::vector<uint8_t> bytes = valid;
+    bytes[info] = bytes[info + 1] = bytes[info + 2] = bytes[info + 3] = 0;
+    SampleBuffer buffer;
+    check(load(bytes, buffer) && matches(stream, buffer), "zeroed block sizes decode in order");
+  }
+  {
+    std::vector<uint8_t> bytes = valid;
+    // stream info block that says it's shorter than it has to be
+    bytes[7] = 20;
+    SampleBuffer buffer;
+    check(!load(bytes, buffer), "short stream info is rejected");
+  }
+  {
+    std::vector<uint8_t> bytes(valid.begin(), valid.begin() + info + 20);
+    SampleBuffer buffer;
+    check(!load(bytes, buffer), "file cut off inside the stream info is rejected");
+  }
+  {
+    std::vector<uint8_t> bytes(valid.begin(), valid.begin() + valid.size() / 2);
+    SampleBuffer buffer;
+    check(load(bytes, buffer) && buffer.length == stream.frames(), "file cut off mid frame keeps its length");
+  }
+  {
+    // a long run of silence in a small file, which the limit has to catch
+    // whether the length comes from the stream info or from counting
+    TestStream silence = stream;
+    silence.block_size = 4096;
+    silence.blocks = 1;
+    silence.blocks_constant = 3000;
+    std::vector<uint8_t> bytes = silence.encode();
+    SampleBuffer buffer;
+    check(!load(bytes, buffer, (int64_t)1 << 20), "stream past the limit is rejected");
+    bytes[info + 14] = bytes[info + 15] = bytes[info + 16] = bytes[info + 17] = 0;
+    bytes[info + 13] &= 0xf0;
+    check(!load(bytes, buffer, (int64_t)1 << 20), "unknown length stream past the limit is rejected");
+    check(load(bytes, buffer) && matches(silence, buffer), "the same stream loads under the default limit");
+  }
+
+  std::filesystem::remove(std::filesystem::temp_directory_path() / "alefsbits-test.flac");
+  return failures ? 1 : 0;
+}